@@ -1,23 +1,51 @@
 #include <vector>
 #include <algorithm>
-#include <list>
 
 #include "Vec3d.cpp"
 #include "Mesh.cpp"
+#include "Terrain.cpp"
 #include "Mat4x4.cpp"
 #include "Triangle.cpp"
+#include "Clipper.cpp"
+#include "Transform.cpp"
+#include "Texture.cpp"
 #include "GameEngine.cpp"
 
 const int WIDTH = 1024;
 const int HEIGHT = 960;
 
+// Distance between the heights the terrain samples from the mesh
+const float TERRAIN_SPACING = 2.5f;
+
+// Terrain from textures/heightmap.bmp or .tga when there's one: distance
+// between its pixels, and the height of white
+const float HEIGHTMAP_SPACING = 1;
+const float HEIGHTMAP_SCALE = 60;
+
+// Threads rasterizing the screen tiles, 0 uses one per core
+const int RASTER_THREADS = 0;
+
+// Frames waiting to be shown by the present thread while the next one is
+// drawn, 0 presents them on the main thread. The thread is for Linux with
+// X11 only, see GameEngine::CreateWindow().
+#ifdef __linux__
+const int FRAMES_IN_FLIGHT = 2;
+#else
+const int FRAMES_IN_FLIGHT = 0;
+#endif
+
 class Video3DEngine : public GameEngine {
     private:
         Mesh mesh;
-        Mat4x4 matWorld, matRotX, matRotZ, matTrans, matProj;
+        Texture texture;
+        Mat4x4 matWorld, matRotX, matRotZ, matTrans, matView, matProj;
+
+        // Clip space frustum, sides out to the renderer's guard band
+        Clipper clipper;
 
-        // Camera
+        // Camera, and where it is in the mesh's object space
         Vec3d vCamera;
+        Vec3d vCameraObject;
         Vec3d vLookDir;
         Vec3d vForward;
         Vec3d vVel;
@@ -29,6 +57,10 @@ class Video3DEngine : public GameEngine {
         float fYawSpeed;
         float fLateralSpeed;
 
+        // Walking on the mesh, the camera stays this high above it
+        bool bGroundFollow;
+        float fEyeHeight;
+
         // Projection Matrix
         float fFovDegrees;
         float fAspectRatio;
@@ -37,6 +69,434 @@ class Video3DEngine : public GameEngine {
 
         float fTheta;
 
+        // Rendering
+        bool bPainterSort;
+        bool bWireframe;
+
+        // Frustum culling, of the whole mesh then of its chunks
+        std::vector<uint32_t> visibleChunks;
+        std::vector<int32_t> chunkOutside;
+        int nMeshesOutside;
+        int nChunksOutside;
+
+        // Occlusion culling
+        bool bOcclusionCulling;
+        float fOccluderFraction;
+        int nMeshesCulled;
+        int nChunksCulled;
+
+        // Levels of detail, the coarsest level of each cluster whose error
+        // covers at most fLodPixels * 2^fLodBias pixels on the screen
+        bool bLod;
+        float fLodPixels;
+        float fLodBias;
+        std::vector<uint8_t> clusterLevel;
+        std::vector<bool> clusterDrawn;
+        int nTrianglesProjected;
+
+        // Mesh vertices through matObjectToClip and their smooth shaded
+        // colors, valid for the vertices whose vertexFrame is nFrame.
+        // Triangles sharing a vertex find it there instead of transforming
+        // it again.
+        Mat4x4 matObjectToClip;
+        ProjectedVertices projectedVertices;
+        std::vector<uint32_t> vertexColors;
+        std::vector<uint32_t> vertexFrame;
+        uint32_t nFrame;
+        int nVerticesTransformed;
+
+        // The mesh resampled into a heightmap, drawn by patches at the level
+        // of the geomipmap their error allows, the same way as the clusters
+        Terrain terrain;
+        bool bTerrain;
+        std::vector<uint32_t> visiblePatches;
+        std::vector<int32_t> patchOutside;
+        std::vector<int8_t> patchLevel;
+        std::vector<Triangle> patchTris;
+        std::vector<Vec3d> patchPlanes;
+        int nPatchesOutside;
+
+        // Lambert lighting of a world space normal, as a grey 0xRRGGBB
+        uint32_t Shade(const Vec3d &n) const {
+            Vec3d light_direction = { 0, 1, -1 };
+            light_direction.normalize();
+
+            float dp = std::max(0.1f, n.dot(light_direction));
+            uint32_t b = dp * 255 + 0.5; // brightness
+
+            return (b << 16) + (b << 8) + b;
+        }
+
+        // Clips a clip space triangle against the frustum, its sides widened
+        // to the renderer's guard band, and projects what's left into screen
+        // space. Nothing outside gets divided.
+        void ClipAndProject(const Triangle &triClip, std::vector<Triangle> &out) {
+            Triangle clipped[CLIP_TRIANGLES_MAX];
+            int nClippedTriangles = clipper.Clip(triClip, clipped);
+
+            for (int n = 0; n < nClippedTriangles; n++) {
+
+                Triangle triProjected = clipped[n];
+
+                // Texture coordinates divided by w interpolate linearly on the screen
+                for (int i = 0; i < 3; i++) {
+                    triProjected.t[i].u /= triProjected.p[i].w;
+                    triProjected.t[i].v /= triProjected.p[i].w;
+                    triProjected.t[i].w = 1.0f / triProjected.p[i].w;
+                }
+
+                triProjected.p[0] /= triProjected.p[0].w;
+                triProjected.p[1] /= triProjected.p[1].w;
+                triProjected.p[2] /= triProjected.p[2].w;
+
+                // Scale into view
+                triProjected += Vec3d(1, 1, 0);
+                triProjected *= Vec3d(0.5 * (float) renderer.width, 0.5 * (float) renderer.height, 1);
+
+                // Store Triangles for sorting
+                out.push_back(triProjected);
+            }
+        }
+
+        // Transforms, lights, clips against the near plane and projects a run
+        // of triangles, facing the camera, into screen space. Back faces are
+        // culled on their object space planes, before they're copied.
+        void ProjectTriangles(const Triangle* tris, const Vec3d* planes, uint32_t count, std::vector<Triangle> &out) {
+            for (uint32_t i = 0; i < count; i++) {
+                if (planes[i].dot(vCameraObject) + planes[i].w > 0.0f) {
+                    nTrianglesProjected++;
+
+                    const Triangle &tri = tris[i];
+                    Triangle triTransformed, triViewed;
+
+                    triTransformed = matWorld * tri;
+
+                    // matWorld only rotates and moves, the normal stays a unit vector
+                    triTransformed.col = Shade(matWorld.MultiplyDirection(planes[i]));
+
+                    // Smooth shading lights the vertices, with their normals in world space
+                    if (renderer.shadeMode == SHADE_SMOOTH) {
+                        for (int j = 0; j < 3; j++)
+                            triTransformed.c[j] = Shade(matWorld.MultiplyDirection(tri.n[j]).normalized());
+                    }
+
+                    // Convert World Space --> View Space --> Clip Space
+                    triViewed = matView * triTransformed;
+                    ClipAndProject(matProj * triViewed, out);
+                }
+            }
+        }
+
+        // A run of mesh vertices into clip and screen space by the SIMD
+        // kernels, lit when the shading is smooth
+        void TransformVertexRun(uint32_t first, uint32_t count) {
+            TransformVertices(renderer.simdLevel, matObjectToClip, clipper, 0.5f * renderer.width, 0.5f * renderer.height,
+                              mesh.vertices, first, count, projectedVertices);
+
+            for (uint32_t v = first; v < first + count; v++) {
+                vertexColors[v] = 0;
+                if (renderer.shadeMode == SHADE_SMOOTH)
+                    vertexColors[v] = Shade(matWorld.MultiplyDirection(mesh.vertices.n[v]).normalized());
+
+                vertexFrame[v] = nFrame;
+            }
+
+            nVerticesTransformed += count;
+        }
+
+        // A vertex the first time a triangle of the frame needs it, the ones
+        // a chunk owns are done together before
+        void ProjectVertex(uint32_t v) {
+            if (vertexFrame[v] != nFrame)
+                TransformVertexRun(v, 1);
+        }
+
+        // ProjectTriangles() for mesh triangles given by their indices, only
+        // the vertices of the front faces are transformed, once each a frame.
+        // Triangles within the guard band skip the clipper and take the
+        // screen positions of their vertices as they are.
+        void ProjectIndexed(const uint32_t* indices, const Vec3d* planes, uint32_t count, std::vector<Triangle> &out) {
+            const ProjectedVertices &projected = projectedVertices;
+
+            for (uint32_t i = 0; i < count; i++) {
+                if (planes[i].dot(vCameraObject) + planes[i].w > 0.0f) {
+                    nTrianglesProjected++;
+
+                    const uint32_t* v = &indices[i * 3];
+                    for (int j = 0; j < 3; j++)
+                        ProjectVertex(v[j]);
+
+                    // Outside one plane, or crossing the guard band
+                    uint32_t c0 = projected.outcode[v[0]], c1 = projected.outcode[v[1]], c2 = projected.outcode[v[2]];
+                    if (c0 & c1 & c2 & 0xff)
+                        continue;
+
+                    bool clip = (c0 | c1 | c2) >> 8;
+
+                    Triangle tri;
+                    for (int j = 0; j < 3; j++) {
+                        tri.c[j] = vertexColors[v[j]];
+                        tri.t[j] = mesh.vertices.t[v[j]];
+
+                        if (clip) {
+                            tri.p[j] = projected.Clip(v[j]);
+                        } else {
+                            tri.p[j] = projected.Screen(v[j]);
+                            tri.t[j].u /= tri.p[j].w;
+                            tri.t[j].v /= tri.p[j].w;
+                            tri.t[j].w = 1.0f / tri.p[j].w;
+                        }
+                    }
+
+                    tri.col = Shade(matWorld.MultiplyDirection(planes[i]));
+
+                    if (clip)
+                        ClipAndProject(tri, out);
+                    else
+                        out.push_back(tri);
+                }
+            }
+        }
+
+        // The renderer clips what reaches past its guard band, the rest is
+        // left to the scissor of the rasterizers
+        void RasterTriangles(std::vector<Triangle> &tris) {
+            for (auto &triangle : tris) {
+                if (bWireframe)
+                    renderer.DrawTriangle(triangle, WHITE);
+                else
+                    renderer.FillTriangle(triangle);
+            }
+        }
+
+        // Screen space bounds of a world space box, false when it's crossing the near plane
+        bool ProjectBox(const Vec3d &bbMin, const Vec3d &bbMax, const Mat4x4 &matWorldViewProj,
+                        float &minX, float &minY, float &maxX, float &maxY, float &zMin, float &zMax) {
+            for (int i = 0; i < 8; i++) {
+                Vec3d corner = { i & 1 ? bbMax.x : bbMin.x,
+                                 i & 2 ? bbMax.y : bbMin.y,
+                                 i & 4 ? bbMax.z : bbMin.z };
+
+                Vec3d p = matWorldViewProj * corner;
+                if (p.w < fNear)
+                    return false;
+
+                p /= p.w;
+                p += Vec3d(1, 1, 0);
+                p *= Vec3d(0.5 * (float) renderer.width, 0.5 * (float) renderer.height, 1);
+
+                if (i == 0) {
+                    minX = maxX = p.x;
+                    minY = maxY = p.y;
+                    zMin = zMax = p.z;
+                } else {
+                    minX = std::min(minX, p.x); maxX = std::max(maxX, p.x);
+                    minY = std::min(minY, p.y); maxY = std::max(maxY, p.y);
+                    zMin = std::min(zMin, p.z); zMax = std::max(zMax, p.z);
+                }
+            }
+
+            return true;
+        }
+
+        bool IsBoxOccluded(const Vec3d &bbMin, const Vec3d &bbMax, const Mat4x4 &matWorldViewProj) {
+            float minX, minY, maxX, maxY, zMin, zMax;
+
+            if (!ProjectBox(bbMin, bbMax, matWorldViewProj, minX, minY, maxX, maxY, zMin, zMax))
+                return false;
+
+            return renderer.IsOccluded(minX, minY, maxX, maxY, zMin, zMax);
+        }
+
+        // Puts the chunks of the mesh that may be in view in visibleChunks,
+        // none when the mesh's sphere or box is outside the frustum
+        void CullChunks(const Mat4x4 &matWorldViewProj) {
+            visibleChunks.clear();
+
+            Frustum frustum = Frustum::FromMatrix(matWorldViewProj);
+            if (frustum.IsSphereOutside(mesh.center, mesh.radius) || frustum.IsBoxOutside(mesh.bbMin, mesh.bbMax)) {
+                nMeshesOutside++;
+                return;
+            }
+
+            // Down the hierarchy, the chunks of the leaves crossing the
+            // frustum are tested on their own
+            chunkOutside.resize(mesh.chunks.size());
+            mesh.bvh.Cull(frustum, [&](uint32_t first, uint32_t count, bool inside) {
+                if (!inside)
+                    CullBoxes(renderer.simdLevel, frustum, mesh.chunkBoxes, first, count, chunkOutside.data());
+
+                for (uint32_t i = first; i < first + count; i++)
+                    if (inside || !chunkOutside[i])
+                        visibleChunks.push_back(i);
+            });
+
+            nChunksOutside += mesh.chunks.size() - visibleChunks.size();
+        }
+
+        // Whether an object space error anywhere in the sphere covers at most
+        // the pixels allowed, seen from the sphere's nearest point
+        bool IsErrorHidden(float error, const Vec3d &center, float radius) const {
+            // Pixels an object unit covers at a distance of 1
+            float fPixelsPerUnit = 0.5f * renderer.height * matProj.m[1][1];
+            float fDistance = std::max(fNear, ((matWorld * center) - vCamera).length() - radius);
+
+            return error * fPixelsPerUnit <= fLodPixels * exp2f(fLodBias) * fDistance;
+        }
+
+        // Picks the coarsest level of each cluster whose error is hidden
+        void SelectLods() {
+            clusterLevel.assign(mesh.clusters.size(), 0);
+            clusterDrawn.assign(mesh.clusters.size(), false);
+            if (!bLod)
+                return;
+
+            for (uint32_t c = 0; c < mesh.clusters.size(); c++) {
+                const MeshCluster &cluster = mesh.clusters[c];
+
+                for (int level = cluster.lods.size(); level > 0; level--) {
+                    if (IsErrorHidden(cluster.lods[level - 1].error, cluster.center, cluster.radius)) {
+                        clusterLevel[c] = level;
+                        break;
+                    }
+                }
+            }
+        }
+
+        // A chunk at full detail, or the whole simplified cluster it's part of
+        // when it's the first of its chunks in view
+        void ProjectChunk(uint32_t i, std::vector<Triangle> &out) {
+            const MeshChunk &chunk = mesh.chunks[i];
+            uint32_t c = mesh.chunkCluster[i];
+
+            if (!clusterLevel[c]) {
+                TransformVertexRun(chunk.firstVertex, chunk.vertexCount);
+                ProjectIndexed(&mesh.indices[chunk.first * 3], &mesh.planes[chunk.first], chunk.count, out);
+                return;
+            }
+
+            if (clusterDrawn[c])
+                return;
+
+            const MeshLod &lod = mesh.clusters[c].lods[clusterLevel[c] - 1];
+            ProjectIndexed(&mesh.lodIndices[lod.first * 3], &mesh.lodPlanes[lod.first], lod.count, out);
+            clusterDrawn[c] = true;
+        }
+
+        // Patches of the terrain that may be in view in visiblePatches, as
+        // CullChunks(). Their levels are picked when they're drawn.
+        void CullPatches(const Mat4x4 &matWorldViewProj) {
+            visiblePatches.clear();
+            patchLevel.assign(terrain.patches.size(), -1);
+
+            Frustum frustum = Frustum::FromMatrix(matWorldViewProj);
+            patchOutside.resize(terrain.patches.size());
+            terrain.bvh.Cull(frustum, [&](uint32_t first, uint32_t count, bool inside) {
+                if (!inside)
+                    CullBoxes(renderer.simdLevel, frustum, terrain.patchBoxes, first, count, patchOutside.data());
+
+                for (uint32_t i = first; i < first + count; i++)
+                    if (inside || !patchOutside[i])
+                        visiblePatches.push_back(i);
+            });
+
+            nPatchesOutside += terrain.patches.size() - visiblePatches.size();
+        }
+
+        // Coarsest level whose error is hidden, only worked out for the
+        // patches in view and their neighbours
+        int PatchLevel(uint32_t i) {
+            if (patchLevel[i] >= 0)
+                return patchLevel[i];
+
+            const TerrainPatch &patch = terrain.patches[i];
+            int level = bLod ? TERRAIN_LEVELS - 1 : 0;
+            while (level > 0 && !IsErrorHidden(patch.errors[level], patch.center, patch.radius))
+                level--;
+
+            patchLevel[i] = level;
+            return level;
+        }
+
+        void ProjectPatch(uint32_t i, std::vector<Triangle> &out) {
+            const TerrainPatch &patch = terrain.patches[i];
+            int level = PatchLevel(i);
+
+            // Sides at the border of the terrain need no stitching
+            int sideLevels[4];
+            for (int side = 0; side < 4; side++) {
+                int neighbour = terrain.Neighbour(patch, side);
+                sideLevels[side] = neighbour < 0 ? level : PatchLevel(neighbour);
+            }
+
+            patchTris.clear();
+            terrain.Triangulate(patch, level, sideLevels, patchTris);
+
+            patchPlanes.resize(patchTris.size());
+            for (uint32_t j = 0; j < patchTris.size(); j++)
+                patchPlanes[j] = patchTris[j].plane();
+
+            ProjectTriangles(patchTris.data(), patchPlanes.data(), patchTris.size(), out);
+        }
+
+        // The chunks of the mesh or the patches of the terrain in view
+        void ProjectVisible(std::vector<Triangle> &out) {
+            if (bTerrain) {
+                for (uint32_t i : visiblePatches)
+                    ProjectPatch(i, out);
+            } else {
+                for (uint32_t i : visibleChunks)
+                    ProjectChunk(i, out);
+            }
+        }
+
+        // Draws the chunks, or patches, in view from front to back. The nearest
+        // ones are the occluders, once they're drawn the depth pyramid is built
+        // and every other one is only drawn if some of it can pass the depth test.
+        void DrawMeshOccluded(const Mat4x4 &matWorldViewProj) {
+            std::vector<Triangle> vecTrianglesToRaster;
+
+            if (!bTerrain && bOcclusionCulling && IsBoxOccluded(mesh.bbMin, mesh.bbMax, matWorldViewProj)) {
+                nMeshesCulled++;
+                return;
+            }
+
+            auto bounds = [&](uint32_t i) -> std::pair<const Vec3d&, const Vec3d&> {
+                if (bTerrain)
+                    return { terrain.patches[i].bbMin, terrain.patches[i].bbMax };
+
+                return { mesh.chunks[i].bbMin, mesh.chunks[i].bbMax };
+            };
+
+            std::vector<std::pair<float, uint32_t>> order;
+            for (uint32_t i : bTerrain ? visiblePatches : visibleChunks) {
+                Vec3d center = matWorld * ((bounds(i).first + bounds(i).second) * 0.5f);
+                order.push_back({ (center - vCamera).length(), i });
+            }
+            sort(order.begin(), order.end());
+
+            size_t nOccluders = order.size() * fOccluderFraction;
+
+            for (size_t n = 0; n < order.size(); n++) {
+                uint32_t i = order[n].second;
+
+                if (bOcclusionCulling && n == nOccluders)
+                    renderer.BuildHiZ();
+
+                if (bOcclusionCulling && n >= nOccluders && IsBoxOccluded(bounds(i).first, bounds(i).second, matWorldViewProj)) {
+                    nChunksCulled++;
+                    continue;
+                }
+
+                vecTrianglesToRaster.clear();
+                if (bTerrain)
+                    ProjectPatch(i, vecTrianglesToRaster);
+                else
+                    ProjectChunk(i, vecTrianglesToRaster);
+                RasterTriangles(vecTrianglesToRaster);
+            }
+        }
+
     public:
         bool OnCreate() override {
             fFovDegrees = 90;
@@ -47,6 +507,22 @@ class Video3DEngine : public GameEngine {
             fTheta = 0;
 
             mesh.LoadFromObjectFile("models/mountains.obj");
+            if (!mesh.bHasTexture)
+                mesh.GeneratePlanarUVs(16);
+
+            // A heightmap is drawn from the start. Without one the terrain
+            // is sampled from the mesh with the same texture coordinates,
+            // and drawn instead of it when bTerrain is set.
+            bTerrain = terrain.LoadHeightmap("textures/heightmap.bmp", HEIGHTMAP_SPACING, HEIGHTMAP_SCALE, 16) ||
+                       terrain.LoadHeightmap("textures/heightmap.tga", HEIGHTMAP_SPACING, HEIGHTMAP_SCALE, 16);
+            if (bTerrain)
+                printf("Terrain: %dx%d heightmap\n", terrain.width, terrain.depth);
+            else
+                terrain.FromMesh(mesh, TERRAIN_SPACING, 16);
+            nPatchesOutside = 0;
+
+            if (!texture.LoadFromFile("textures/ground.bmp") && !texture.LoadFromFile("textures/ground.tga"))
+                texture.CreateChecker(256, 8, 0xffffff, 0x808080);
 
             // Initializing Movement
             fYaw = 0;
@@ -54,11 +530,53 @@ class Video3DEngine : public GameEngine {
             fForwardSpeed = 8;
             fYawSpeed = 2;
             fLateralSpeed = 8;
+            bGroundFollow = false;
+            fEyeHeight = 2;
 
             // Initializing Camera and Projection
             vCamera = { 0, 0, 0 };
             vLookDir = { 0, 0, 1 };
-            matProj = Mat4x4::MakeProjection(fFovDegrees, fAspectRatio, fNear, fFar);
+
+            renderer.SetThreadCount(RASTER_THREADS);
+
+            renderer.SetTexture(&texture);
+            renderer.shadeMode = SHADE_TEXTURED;
+
+            // 28.4 fixed point vertices
+            renderer.subPixelBits = 4;
+
+            // Depth buffer replaces the painter's sort
+            renderer.SetDepthMode(DEPTH_32F, true);
+            bPainterSort = renderer.depthMode == DEPTH_NONE;
+            bWireframe = false;
+
+            // Holds frames to 12 ms of drawing, down to half the resolution
+            bDynamicResolution = true;
+            resolution.targetMs = 12.0f;
+            resolution.minScale = 0.5f;
+            resolution.maxScale = 1.0f;
+            resolution.Reset();
+
+            // Nearest quarter of the chunks are drawn first as occluders
+            bOcclusionCulling = true;
+            fOccluderFraction = 0.25f;
+            nMeshesCulled = 0;
+            nChunksCulled = 0;
+            nMeshesOutside = 0;
+            nChunksOutside = 0;
+
+            // Errors up to a pixel
+            bLod = true;
+            fLodPixels = 1;
+            fLodBias = 0;
+            nTrianglesProjected = 0;
+            nFrame = 0;
+            nVerticesTransformed = 0;
+
+            if (renderer.depthMode != DEPTH_NONE && renderer.reverseZ)
+                matProj = Mat4x4::MakeProjectionReverseZ(fFovDegrees, fAspectRatio, fNear, fFar);
+            else
+                matProj = Mat4x4::MakeProjection(fFovDegrees, fAspectRatio, fNear, fFar);
 
             return true;
         }
@@ -90,6 +608,89 @@ class Video3DEngine : public GameEngine {
                 case SDLK_d:
                     fYawVel = -fYawSpeed;
                     break;
+
+                // Switch rasterizers to compare them on the same scene
+                case SDLK_r: {
+                    const char* sModes[] = { "scanline", "edge functions", "span buffer", "visibility buffer" };
+
+                    renderer.rasterMode = (RasterMode) ((renderer.rasterMode + 1) % 4);
+                    printf("Rasterizer: %s (%s)\n", sModes[renderer.rasterMode], SimdLevelName(renderer.simdLevel));
+                    break;
+                }
+
+                // Flat, smooth or textured, the texture's filter and the affine subdivision
+                case SDLK_t: {
+                    const char* sModes[] = { "flat", "smooth", "textured" };
+
+                    renderer.shadeMode = (ShadeMode) ((renderer.shadeMode + 1) % 3);
+                    printf("Shading: %s\n", sModes[renderer.shadeMode]);
+                    break;
+                }
+                case SDLK_f:
+                    renderer.textureFilter = renderer.textureFilter == FILTER_BILINEAR ? FILTER_NEAREST : FILTER_BILINEAR;
+                    printf("Texture filter: %s\n", renderer.textureFilter == FILTER_BILINEAR ? "bilinear" : "nearest");
+                    break;
+                case SDLK_g:
+                    renderer.textureSubdivide = !renderer.textureSubdivide;
+                    printf("Perspective: %s\n", renderer.textureSubdivide ? "affine subdivision" : "per pixel");
+                    break;
+
+                // Sub-pixel precision and the overdraw it saves on shared edges
+                case SDLK_p:
+                    renderer.subPixelBits = renderer.subPixelBits ? 0 : 4;
+                    printf("Sub-pixel bits: %d\n", renderer.subPixelBits);
+                    break;
+                case SDLK_o:
+                    renderer.SetOverdrawCounting(!renderer.countOverdraw);
+                    break;
+
+                // Triangle edges only, nothing is hidden
+                case SDLK_w:
+                    bWireframe = !bWireframe;
+                    break;
+
+                // Dynamic resolution, back to full size when it's off
+                case SDLK_v:
+                    bDynamicResolution = !bDynamicResolution;
+                    resolution.Reset();
+                    renderer.SetResolution(renderer.outputWidth, renderer.outputHeight);
+                    printf("Dynamic resolution: %s\n", bDynamicResolution ? "on" : "off");
+                    break;
+
+                // The camera walks on the mesh, found by a ray query
+                case SDLK_h:
+                    bGroundFollow = !bGroundFollow;
+                    printf("Ground following: %s\n", bGroundFollow ? "on" : "off");
+                    break;
+
+                // Half the pixels shaded each frame, the others reprojected
+                case SDLK_k:
+                    renderer.checkerboard = !renderer.checkerboard;
+                    printf("Checkerboard: %s\n", renderer.checkerboard ? "on, with the visibility buffer" : "off");
+                    break;
+
+                // Levels of detail, the bias doubles or halves the error allowed
+                case SDLK_l:
+                    bLod = !bLod;
+                    printf("Levels of detail: %s\n", bLod ? "on" : "off");
+                    break;
+                case SDLK_PAGEUP:
+                case SDLK_PAGEDOWN:
+                    fLodBias += kc == SDLK_PAGEUP ? 1 : -1;
+                    printf("LOD bias: %+g, errors up to %g pixels\n", fLodBias, fLodPixels * exp2f(fLodBias));
+                    break;
+
+                // The mesh or the terrain made from it
+                case SDLK_m:
+                    bTerrain = !bTerrain;
+                    printf("Drawing: %s\n", bTerrain ? "terrain, geomipmapped" : "mesh");
+                    break;
+
+                // Fewer shades on the SDL target, for bigger batches of one color
+                case SDLK_c:
+                    renderer.colorBits = renderer.colorBits == 8 ? 5 : renderer.colorBits == 5 ? 3 : 8;
+                    printf("Bits per channel: %d\n", renderer.colorBits);
+                    break;
                 default:
                     break;
             }
@@ -131,6 +732,41 @@ class Video3DEngine : public GameEngine {
             return true;
         }
 
+        std::string OnFrameStats() override {
+            std::string sStats;
+
+            if (bTerrain) {
+                sStats = "Outside the frustum: " + std::to_string(nPatchesOutside) + "/" + std::to_string(terrain.patches.size()) + " patches"
+                         + " - Triangles projected: " + std::to_string(nTrianglesProjected);
+
+                if (bOcclusionCulling && !bPainterSort && renderer.rasterMode != RASTER_SPANS)
+                    sStats += " - Culled patches: " + std::to_string(nChunksCulled) + "/" + std::to_string(terrain.patches.size());
+            } else {
+                sStats = "Outside the frustum: " + std::to_string(nMeshesOutside) + " meshes, "
+                         + std::to_string(nChunksOutside) + "/" + std::to_string(mesh.chunks.size()) + " chunks"
+                         + " - Triangles projected: " + std::to_string(nTrianglesProjected) + "/" + std::to_string(mesh.TriangleCount())
+                         + " - Vertices transformed: " + std::to_string(nVerticesTransformed) + "/" + std::to_string(mesh.vertices.Size());
+
+                if (bOcclusionCulling && !bPainterSort && renderer.rasterMode != RASTER_SPANS)
+                    sStats += " - Culled meshes: " + std::to_string(nMeshesCulled) + " chunks: " + std::to_string(nChunksCulled)
+                              + "/" + std::to_string(mesh.chunks.size());
+            }
+
+            if (renderer.target == TARGET_SDL)
+                sStats += (sStats.empty() ? "" : " - ") + std::string("Draw calls: ") + std::to_string(renderer.drawCalls);
+
+            if (renderer.countOverdraw) {
+                uint64_t nCovered, nTouched;
+                renderer.OverdrawStats(nCovered, nTouched);
+
+                char sOverdraw[64];
+                snprintf(sOverdraw, sizeof(sOverdraw), "Overdraw: %.3f", nTouched ? (double) nCovered / nTouched : 0.0);
+                sStats += (sStats.empty() ? "" : " - ") + std::string(sOverdraw);
+            }
+
+            return sStats;
+        }
+
         bool OnUpdate(float fElapsedTime) override {
                 // Move camera
                 vCamera.x += vVel.x * fElapsedTime;
@@ -139,6 +775,23 @@ class Video3DEngine : public GameEngine {
                 fYaw += fYawVel * fElapsedTime;
 
                 renderer.Fill(BLACK);
+                renderer.ClearDepth();
+
+                nMeshesCulled = 0;
+                nChunksCulled = 0;
+                nMeshesOutside = 0;
+                nChunksOutside = 0;
+                nTrianglesProjected = 0;
+                nVerticesTransformed = 0;
+                nPatchesOutside = 0;
+
+                // Every vertex transformed before is stale
+                nFrame++;
+                if (vertexFrame.size() != mesh.vertices.Size()) {
+                    projectedVertices.Resize(mesh.vertices.Size());
+                    vertexColors.resize(mesh.vertices.Size());
+                    vertexFrame.assign(mesh.vertices.Size(), 0);
+                }
 
                 //fTheta += 1 * fElapsedTime;
 
@@ -146,6 +799,18 @@ class Video3DEngine : public GameEngine {
                 matRotZ = Mat4x4::MakeRotationZ(fTheta);
                 matTrans = Mat4x4::MakeTranslation(0, 0, 8);
                 matWorld = matRotZ * matRotX * matTrans;
+
+                // Ray straight down through the BVH, from high enough to find
+                // the ground under a camera that went below it
+                if (bGroundFollow) {
+                    Mat4x4 matWorldInv = Mat4x4::QuickInverse(matWorld);
+                    Vec3d origin = matWorldInv * Vec3d(vCamera.x, vCamera.y + fFar, vCamera.z);
+                    Vec3d down = matWorldInv.MultiplyDirection({ 0, -1, 0 });
+
+                    RayHit hit;
+                    if (mesh.Raycast(origin, down, 2 * fFar, hit))
+                        vCamera.y += fFar - hit.t + fEyeHeight;
+                }
                 
                 Vec3d vUp = { 0, 1, 0 };
                 Vec3d vTarget = { 0, 0, 1 };
@@ -156,7 +821,16 @@ class Video3DEngine : public GameEngine {
                 Mat4x4 matCamera = Mat4x4::PointAt(vCamera, vTarget, vUp);
 
                 // Make view matrix from camera
-                Mat4x4 matView = Mat4x4::QuickInverse(matCamera);
+                matView = Mat4x4::QuickInverse(matCamera);
+
+                // Faces are culled against the camera in object space
+                vCameraObject = Mat4x4::QuickInverse(matWorld) * vCamera;
+
+                // Lets checkerboard rendering follow the camera between frames
+                renderer.SetViewProjection(matView * matProj * Mat4x4::MakeScreen(renderer.width, renderer.height));
+
+                // The resolution may have changed, and the guard band with it
+                clipper = Clipper::Frustum(1 + 2 * GUARD_BAND / renderer.width, 1 + 2 * GUARD_BAND / renderer.height);
 
                 std::vector<Triangle> vecTrianglesToRaster;
                 std::vector<std::pair<Vec3d, Vec3d>> linesToDraw;
@@ -177,108 +851,43 @@ class Video3DEngine : public GameEngine {
                 //linesToDraw.push_back({ origin, yDir });
                 //linesToDraw.push_back({ origin, zDir });
 
-                // Draw Triangles
-                for (auto tri : mesh.tris) {
-                    Triangle triProjected, triTransformed, triViewed;
-
-                    triTransformed = matWorld * tri;
-
-                    // Calculating Camera Rays to see if the triangle is visible
-                    Vec3d vCameraRay = triTransformed.p[0] - vCamera;
-                    Vec3d normal = triTransformed.normal();
-
-                    if (normal.dot(vCameraRay) < 0.0f) {
-                        // Illumination
-                        Vec3d light_direction = { 0, 1, -1 };
-                        light_direction.normalize();
-                        
-                        float dp = std::max(0.1f, normal.dot(light_direction));
-                        int b = dp * 255 + 0.5; // brightness
-
-                        uint32_t shade = (b << 16) + (b << 8) + b;
-                        triTransformed.col = shade;
+                // Only the chunks or patches in view get their triangles transformed
+                Mat4x4 matWorldViewProj = matWorld * matView * matProj;
+                matObjectToClip = matWorldViewProj;
+                if (bTerrain) {
+                    CullPatches(matWorldViewProj);
+                } else {
+                    CullChunks(matWorldViewProj);
+                    SelectLods();
+                }
 
-                        // Convert World Space --> View Space
-                        triViewed = matView * triTransformed;
+                if (renderer.rasterMode == RASTER_SPANS) {
+                    ProjectVisible(vecTrianglesToRaster);
 
-                        // Clip Viewed Triangle against near plane, this could form two additional
-                        // additional triangles. 
-                        int nClippedTriangles = 0;
-                        Triangle clipped[2];
-                        nClippedTriangles = triViewed.clipAgainstPlane({ 0.0f, 0.0f, 0.1f }, { 0.0f, 0.0f, 1.0f }, clipped[0], clipped[1]);
+                    // Sort Triangles from front to back, on their view space
+                    // depth as the projected z depends on reverse-Z
+                    sort(vecTrianglesToRaster.begin(), vecTrianglesToRaster.end(), [](Triangle &t1, Triangle &t2) {
+                        float w1 = t1.p[0].w + t1.p[1].w + t1.p[2].w;
+                        float w2 = t2.p[0].w + t2.p[1].w + t2.p[2].w;
 
-                        for (int n = 0; n < nClippedTriangles; n++) {
+                        return w1 < w2;
+                    });
 
-                            triProjected = matProj * clipped[n];
-                            triProjected.p[0] /= triProjected.p[0].w;
-                            triProjected.p[1] /= triProjected.p[1].w;
-                            triProjected.p[2] /= triProjected.p[2].w;
+                    RasterTriangles(vecTrianglesToRaster);
+                } else if (bPainterSort) {
+                    ProjectVisible(vecTrianglesToRaster);
 
-                            // Scale into view
-                            triProjected += Vec3d(1, 1, 0);
-                            triProjected *= Vec3d(0.5 * (float) WIDTH, 0.5 * (float) HEIGHT, 1);
+                    // Sort Triangles from back to front
+                    sort(vecTrianglesToRaster.begin(), vecTrianglesToRaster.end(), [](Triangle &t1, Triangle &t2) {
+                        float z1 = (t1.p[0].z + t1.p[1].z + t1.p[2].z) / 3;
+                        float z2 = (t2.p[0].z + t2.p[1].z + t2.p[2].z) / 3;
 
-                            // Store Triangles for sorting
-                            vecTrianglesToRaster.push_back(triProjected);
-                        }
-                    }
-                }
+                        return z1 > z2;
+                    });
 
-                // Sort Triangles from back to front
-                sort(vecTrianglesToRaster.begin(), vecTrianglesToRaster.end(), [](Triangle &t1, Triangle &t2) {
-                    float z1 = (t1.p[0].z + t1.p[1].z + t1.p[2].z) / 3;
-                    float z2 = (t2.p[0].z + t2.p[1].z + t2.p[2].z) / 3;
-
-                    return z1 > z2;
-                });
-
-                for (auto &triToRaster : vecTrianglesToRaster) {
-                    // Clip triangles against all four screen edges, this could yield
-                    // a bunch of triangles, so create a queue that we traverse to 
-                    //  ensure we only test new triangles generated against planes
-                    Triangle clipped[2];
-                    std::list<Triangle> listTriangles;
-
-                    // Add initial triangle
-                    listTriangles.push_back(triToRaster);
-                    int nNewTriangles = 1;
-
-                    for (int p = 0; p < 4; p++) {
-                        int nTrisToAdd = 0;
-                        while (nNewTriangles > 0) {
-                            // Take triangle from front of queue
-                            Triangle test = listTriangles.front();
-                            listTriangles.pop_front();
-                            nNewTriangles--;
-
-                            // Clip it against a plane. We only need to test each 
-                            // subsequent plane, against subsequent new triangles
-                            // as all triangles after a plane clip are guaranteed
-                            // to lie on the inside of the plane. I like how this
-                            // comment is almost completely and utterly justified
-                            switch (p) {
-                                case 0:	nTrisToAdd = test.clipAgainstPlane({ 0, 0, 0 }, { 0, 1, 0 }, clipped[0], clipped[1]); break;
-                                case 1:	nTrisToAdd = test.clipAgainstPlane({ 0, (float)HEIGHT - 1, 0 }, { 0, -1, 0 }, clipped[0], clipped[1]); break;
-                                case 2:	nTrisToAdd = test.clipAgainstPlane({ 0, 0, 0 }, { 1, 0, 0 }, clipped[0], clipped[1]); break;
-                                case 3:	nTrisToAdd = test.clipAgainstPlane({ (float)WIDTH - 1, 0, 0 }, { -1, 0, 0 }, clipped[0], clipped[1]); break;
-                            }
-
-                            // Clipping may yield a variable number of triangles, so
-                            // add these new ones to the back of the queue for subsequent
-                            // clipping against next planes
-                            for (int w = 0; w < nTrisToAdd; w++)
-                                listTriangles.push_back(clipped[w]);
-                        }
-                        nNewTriangles = listTriangles.size();
-                    }
-
-
-                    // Draw the transformed, viewed, clipped, projected, sorted, clipped triangles
-                    for (auto &triangle : listTriangles) {
-                        // Rasterize Triangle
-                        renderer.FillTriangle(triangle);
-                        //renderer.DrawTriangle(triangle, RED);
-                    }
+                    RasterTriangles(vecTrianglesToRaster);
+                } else {
+                    DrawMeshOccluded(matWorldViewProj);
                 }
 
                 for (auto &line : linesToDraw) {
@@ -298,8 +907,8 @@ class Video3DEngine : public GameEngine {
                     // Scale into view
                     p1 += Vec3d(1, 1, 0);
                     p2 += Vec3d(1, 1, 0);
-                    p1 *= Vec3d(0.5 * (float) WIDTH, 0.5 * (float) HEIGHT, 1);
-                    p2 *= Vec3d(0.5 * (float) WIDTH, 0.5 * (float) HEIGHT, 1);
+                    p1 *= Vec3d(0.5 * (float) renderer.width, 0.5 * (float) renderer.height, 1);
+                    p2 *= Vec3d(0.5 * (float) renderer.width, 0.5 * (float) renderer.height, 1);
 
                     renderer.DrawLine(p1, p2, GREEN);
                 }
@@ -313,7 +922,7 @@ int main()
 {
     Video3DEngine demo;
 
-    if (demo.CreateWindow("3D Demo", WIDTH, HEIGHT)) {
+    if (demo.CreateWindow("3D Demo", WIDTH, HEIGHT, FRAMES_IN_FLIGHT)) {
         demo.Start();
     }
 
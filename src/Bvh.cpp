@@ -0,0 +1,164 @@
+#ifndef _BVH
+#define _BVH
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "Vec3d.cpp"
+#include "Frustum.cpp"
+
+// Most items in a leaf of the BVH, a leaf crossing the frustum has them
+// tested together by CullBoxes()
+const int BVH_LEAF_ITEMS = 8;
+
+// Inner nodes have their first child right after them and the second one
+// at `second`, leaves have second = 0. Either way the node covers items
+// [first, first + count).
+struct BvhNode {
+    Vec3d bbMin, bbMax;
+    uint32_t first, count;
+    uint32_t second;
+};
+
+// Bounding volume hierarchy over boxed items, mesh chunks here. Items are
+// expected in an order that keeps neighbours close in space, like the
+// Morton order of the mesh, and each node covers a run of them so a
+// subtree stands for one range of items.
+struct Bvh {
+    std::vector<BvhNode> nodes;
+
+    void Build(const BoxArrays &boxes) {
+        nodes.clear();
+        if (boxes.Size() > 0)
+            Build(boxes, 0, boxes.Size());
+    }
+
+    uint32_t Build(const BoxArrays &boxes, uint32_t first, uint32_t count) {
+        uint32_t index = nodes.size();
+        nodes.push_back(BvhNode());
+
+        BvhNode node;
+        node.first = first;
+        node.count = count;
+        node.second = 0;
+        node.bbMin = { boxes.cx[first] - boxes.ex[first], boxes.cy[first] - boxes.ey[first], boxes.cz[first] - boxes.ez[first] };
+        node.bbMax = { boxes.cx[first] + boxes.ex[first], boxes.cy[first] + boxes.ey[first], boxes.cz[first] + boxes.ez[first] };
+
+        for (uint32_t i = first + 1; i < first + count; i++) {
+            node.bbMin.x = std::min(node.bbMin.x, boxes.cx[i] - boxes.ex[i]);
+            node.bbMin.y = std::min(node.bbMin.y, boxes.cy[i] - boxes.ey[i]);
+            node.bbMin.z = std::min(node.bbMin.z, boxes.cz[i] - boxes.ez[i]);
+            node.bbMax.x = std::max(node.bbMax.x, boxes.cx[i] + boxes.ex[i]);
+            node.bbMax.y = std::max(node.bbMax.y, boxes.cy[i] + boxes.ey[i]);
+            node.bbMax.z = std::max(node.bbMax.z, boxes.cz[i] + boxes.ez[i]);
+        }
+
+        // Halves of the run are halves of the space along the Morton curve
+        if (count > (uint32_t) BVH_LEAF_ITEMS) {
+            uint32_t half = count / 2;
+            Build(boxes, first, half);
+            node.second = Build(boxes, first + half, count - half);
+        }
+
+        nodes[index] = node;
+        return index;
+    }
+
+    // Calls visit(first, count, inside) for the runs of items the frustum
+    // may see. Subtrees all inside come whole with inside set and aren't
+    // tested further, leaves crossing it come with inside false.
+    template <typename F>
+    void Cull(const Frustum &f, F visit) const {
+        if (!nodes.empty())
+            Cull(f, 0, FRUSTUM_ALL_PLANES, visit);
+    }
+
+    template <typename F>
+    void Cull(const Frustum &f, uint32_t index, int planes, F &visit) const {
+        const BvhNode &node = nodes[index];
+
+        // Planes the parent is inside of are inside of the children too
+        int result = f.ClassifyBox(node.bbMin, node.bbMax, planes);
+        if (result < 0)
+            return;
+
+        if (result > 0 || !node.second) {
+            visit(node.first, node.count, result > 0);
+            return;
+        }
+
+        Cull(f, index + 1, planes, visit);
+        Cull(f, node.second, planes, visit);
+    }
+
+    // Distance along the ray to the box, in [0, tMax], or -1 when it misses.
+    // invDir is 1 / dir, infinite where dir is 0.
+    static float IntersectBox(const Vec3d &bbMin, const Vec3d &bbMax, const Vec3d &origin, const Vec3d &invDir, float tMax) {
+        float t0 = 0, t1 = tMax;
+        const float o[3] = { origin.x, origin.y, origin.z };
+        const float d[3] = { invDir.x, invDir.y, invDir.z };
+        const float lo[3] = { bbMin.x, bbMin.y, bbMin.z };
+        const float hi[3] = { bbMax.x, bbMax.y, bbMax.z };
+
+        for (int i = 0; i < 3; i++) {
+            float a = (lo[i] - o[i]) * d[i];
+            float b = (hi[i] - o[i]) * d[i];
+
+            // NaN when the origin is on a slab of a ray parallel to it, it
+            // doesn't narrow anything then
+            if (a > b)
+                std::swap(a, b);
+            if (a > t0) t0 = a;
+            if (b < t1) t1 = b;
+        }
+
+        return t0 <= t1 ? t0 : -1;
+    }
+
+    // Closest hit of the ray within tMax. hit(first, count, tMax) tests
+    // the items of a leaf, shrinks tMax to its closest hit and returns true
+    // if it found one. Nearer children are visited first, so far leaves are
+    // mostly skipped.
+    template <typename F>
+    bool Raycast(const Vec3d &origin, const Vec3d &dir, float &tMax, F hit) const {
+        if (nodes.empty())
+            return false;
+
+        Vec3d invDir = { 1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z };
+        bool found = false;
+
+        // Depth is log2 of the items, 64 levels are plenty
+        uint32_t stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const BvhNode &node = nodes[stack[--top]];
+            if (IntersectBox(node.bbMin, node.bbMax, origin, invDir, tMax) < 0)
+                continue;
+
+            if (!node.second) {
+                found |= hit(node.first, node.count, tMax);
+                continue;
+            }
+
+            uint32_t a = &node - &nodes[0] + 1, b = node.second;
+            float ta = IntersectBox(nodes[a].bbMin, nodes[a].bbMax, origin, invDir, tMax);
+            float tb = IntersectBox(nodes[b].bbMin, nodes[b].bbMax, origin, invDir, tMax);
+
+            // The nearer one is popped first
+            if (ta >= 0 && tb >= 0 && tb < ta) {
+                std::swap(a, b);
+                std::swap(ta, tb);
+            }
+            if (tb >= 0 && top < 64) stack[top++] = b;
+            if (ta >= 0 && top < 64) stack[top++] = a;
+        }
+
+        return found;
+    }
+};
+
+#endif
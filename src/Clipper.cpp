@@ -0,0 +1,166 @@
+#ifndef _CLIPPER
+#define _CLIPPER
+
+#include <stdint.h>
+#include "Vec2d.cpp"
+#include "Vec3d.cpp"
+#include "Triangle.cpp"
+
+// Most planes a Clipper clips against
+const int CLIP_PLANES_MAX = 6;
+
+// Each plane cuts one corner off the polygon, adding at most one vertex
+const int CLIP_VERTICES_MAX = 3 + CLIP_PLANES_MAX;
+
+// Most triangles a clipped triangle turns into, a fan of the polygon
+const int CLIP_TRIANGLES_MAX = CLIP_VERTICES_MAX - 2;
+
+// Inside of the plane is x * p.x + y * p.y + z * p.z + w * p.w >= 0, in
+// homogeneous coordinates. Triangles are clipped where guard * p.w more
+// is still negative, a wider plane than the one they're culled by.
+struct ClipPlane {
+    float x, y, z, w;
+    float guard;
+
+    float Distance(const Vec3d &p) const {
+        return x * p.x + y * p.y + z * p.z + w * p.w;
+    }
+};
+
+// Sutherland-Hodgman clipping of triangles against a few planes, in a
+// polygon of fixed size. Texture coordinates and vertex colors are
+// interpolated linearly, so clip space triangles are clipped before the
+// perspective divide.
+struct Clipper {
+    ClipPlane planes[CLIP_PLANES_MAX];
+    int planeCount;
+
+    Clipper() {
+        planeCount = 0;
+    }
+
+    void AddPlane(float x, float y, float z, float w, float guard = 0) {
+        if (planeCount < CLIP_PLANES_MAX)
+            planes[planeCount++] = { x, y, z, w, guard };
+    }
+
+    // The view frustum in the clip space of Mat4x4::MakeProjection(), and
+    // its reverse-Z one, -w <= x, y <= w and 0 <= z <= w. The sides are
+    // clipped gx and gy times further, which can be a guard band.
+    static Clipper Frustum(float gx = 1, float gy = 1) {
+        Clipper c;
+
+        c.AddPlane( 1,  0,  0, 1, gx - 1);
+        c.AddPlane(-1,  0,  0, 1, gx - 1);
+        c.AddPlane( 0,  1,  0, 1, gy - 1);
+        c.AddPlane( 0, -1,  0, 1, gy - 1);
+        c.AddPlane( 0,  0,  1, 0);
+        c.AddPlane( 0,  0, -1, 1);
+
+        return c;
+    }
+
+    // Bit i is set when p is outside plane i, bit i + 8 when it's outside
+    // with the guard too
+    uint32_t Outcode(const Vec3d &p) const {
+        uint32_t code = 0;
+
+        for (int i = 0; i < planeCount; i++) {
+            float d = planes[i].Distance(p);
+
+            if (d < 0)
+                code |= 1 << i;
+            if (d + planes[i].guard * p.w < 0)
+                code |= 1 << (i + 8);
+        }
+
+        return code;
+    }
+
+    // Puts the parts of tri inside every plane in out, which holds
+    // CLIP_TRIANGLES_MAX triangles, and returns how many. Triangles all
+    // outside one plane are culled, those inside the guard come out as
+    // they are, without any arithmetic.
+    int Clip(const Triangle &tri, Triangle* out) const {
+        uint32_t c0 = Outcode(tri.p[0]);
+        uint32_t c1 = Outcode(tri.p[1]);
+        uint32_t c2 = Outcode(tri.p[2]);
+
+        if (c0 & c1 & c2 & 0xff)
+            return 0;
+
+        uint32_t crossed = (c0 | c1 | c2) >> 8;
+        if (!crossed) {
+            out[0] = tri;
+            return 1;
+        }
+
+        struct Vertex {
+            Vec3d p;
+            Vec2d t;
+            uint32_t c;
+        };
+
+        Vertex polygon[2][CLIP_VERTICES_MAX];
+        int n = 3;
+
+        for (int i = 0; i < 3; i++)
+            polygon[0][i] = { tri.p[i], tri.t[i], tri.c[i] };
+
+        // Back and forth between the two polygons, only against the planes
+        // some vertex is outside of
+        int from = 0;
+        for (int i = 0; i < planeCount && n > 0; i++) {
+            if (!(crossed & (1 << i)))
+                continue;
+
+            const ClipPlane &plane = planes[i];
+            const Vertex* in = polygon[from];
+            Vertex* result = polygon[from ^ 1];
+            int count = 0;
+
+            for (int j = 0; j < n; j++) {
+                const Vertex &a = in[j];
+                const Vertex &b = in[(j + 1) % n];
+                float da = plane.Distance(a.p) + plane.guard * a.p.w;
+                float db = plane.Distance(b.p) + plane.guard * b.p.w;
+
+                if (da >= 0)
+                    result[count++] = a;
+
+                // The edge crosses the plane, s is where from a to b
+                if ((da >= 0) != (db >= 0)) {
+                    float s = da / (da - db);
+                    Vertex &v = result[count++];
+
+                    v.p = a.p + (b.p - a.p) * s;
+                    v.p.w = a.p.w + (b.p.w - a.p.w) * s;
+                    v.t = a.t + (b.t - a.t) * s;
+                    v.c = LerpColor(a.c, b.c, s);
+                }
+            }
+
+            from ^= 1;
+            n = count;
+        }
+
+        const Vertex* v = polygon[from];
+        int count = 0;
+
+        for (int i = 1; i + 1 < n; i++) {
+            Triangle &t = out[count++];
+            const Vertex* fan[3] = { &v[0], &v[i], &v[i + 1] };
+
+            t.col = tri.col;
+            for (int j = 0; j < 3; j++) {
+                t.p[j] = fan[j]->p;
+                t.t[j] = fan[j]->t;
+                t.c[j] = fan[j]->c;
+            }
+        }
+
+        return count;
+    }
+};
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef _FRUSTUM
+#define _FRUSTUM
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+
+#include "Vec3d.cpp"
+#include "Mat4x4.cpp"
+#include "Simd.cpp"
+
+// Boxes as their centers and half sizes, one array per coordinate so that
+// the SIMD tests load several boxes at once
+struct BoxArrays {
+    std::vector<float> cx, cy, cz;
+    std::vector<float> ex, ey, ez;
+
+    void Clear() {
+        for (std::vector<float>* v : { &cx, &cy, &cz, &ex, &ey, &ez })
+            v->clear();
+    }
+
+    void Add(const Vec3d &bbMin, const Vec3d &bbMax) {
+        cx.push_back((bbMin.x + bbMax.x) * 0.5f);
+        cy.push_back((bbMin.y + bbMax.y) * 0.5f);
+        cz.push_back((bbMin.z + bbMax.z) * 0.5f);
+        ex.push_back((bbMax.x - bbMin.x) * 0.5f);
+        ey.push_back((bbMax.y - bbMin.y) * 0.5f);
+        ez.push_back((bbMax.z - bbMin.z) * 0.5f);
+    }
+
+    int Size() const {
+        return cx.size();
+    }
+};
+
+// Bits of the planes Frustum::ClassifyBox() tests
+const int FRUSTUM_ALL_PLANES = 0x3f;
+
+// The six planes of a view frustum in the space of what's tested against
+// it, inside is a x + b y + c z + d >= 0 with (a, b, c) of unit length.
+// Tests are conservative, something outside can pass near the corners.
+struct Frustum {
+    float a[6], b[6], c[6], d[6];
+
+    // From the matrix taking that space to clip space, row vectors like
+    // Mat4x4, where the frustum is -w <= x, y <= w and 0 <= z <= w as for
+    // Clipper::Frustum()
+    static Frustum FromMatrix(const Mat4x4 &m) {
+        // Clip space coordinates as combinations of the columns
+        const float sign[6][4] = {
+            {  1,  0,  0, 1 },
+            { -1,  0,  0, 1 },
+            {  0,  1,  0, 1 },
+            {  0, -1,  0, 1 },
+            {  0,  0,  1, 0 },
+            {  0,  0, -1, 1 },
+        };
+
+        Frustum f;
+        for (int i = 0; i < 6; i++) {
+            float p[4];
+            for (int j = 0; j < 4; j++)
+                p[j] = sign[i][0] * m.m[j][0] + sign[i][1] * m.m[j][1] + sign[i][2] * m.m[j][2] + sign[i][3] * m.m[j][3];
+
+            float l = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+            if (l == 0)
+                l = 1;
+
+            f.a[i] = p[0] / l;
+            f.b[i] = p[1] / l;
+            f.c[i] = p[2] / l;
+            f.d[i] = p[3] / l;
+        }
+
+        return f;
+    }
+
+    bool IsSphereOutside(const Vec3d &center, float radius) const {
+        for (int i = 0; i < 6; i++)
+            if (a[i] * center.x + b[i] * center.y + c[i] * center.z + d[i] < -radius)
+                return true;
+
+        return false;
+    }
+
+    // Outside when the corner furthest along the normal of a plane is
+    // behind it
+    bool IsBoxOutside(const Vec3d &bbMin, const Vec3d &bbMax) const {
+        for (int i = 0; i < 6; i++) {
+            float x = a[i] > 0 ? bbMax.x : bbMin.x;
+            float y = b[i] > 0 ? bbMax.y : bbMin.y;
+            float z = c[i] > 0 ? bbMax.z : bbMin.z;
+
+            if (a[i] * x + b[i] * y + c[i] * z + d[i] < 0)
+                return true;
+        }
+
+        return false;
+    }
+
+    // -1 when the box is outside, 1 when it's inside and 0 when it crosses
+    // the frustum. Only the planes with their bit set in `planes` are
+    // tested, those the box is inside of are cleared for its children.
+    int ClassifyBox(const Vec3d &bbMin, const Vec3d &bbMax, int &planes) const {
+        for (int i = 0; i < 6; i++) {
+            if (!(planes & (1 << i)))
+                continue;
+
+            // Corners furthest and nearest along the normal
+            float fx = a[i] > 0 ? bbMax.x : bbMin.x, nx = a[i] > 0 ? bbMin.x : bbMax.x;
+            float fy = b[i] > 0 ? bbMax.y : bbMin.y, ny = b[i] > 0 ? bbMin.y : bbMax.y;
+            float fz = c[i] > 0 ? bbMax.z : bbMin.z, nz = c[i] > 0 ? bbMin.z : bbMax.z;
+
+            if (a[i] * fx + b[i] * fy + c[i] * fz + d[i] < 0)
+                return -1;
+            if (a[i] * nx + b[i] * ny + c[i] * nz + d[i] >= 0)
+                planes &= ~(1 << i);
+        }
+
+        return planes ? 0 : 1;
+    }
+};
+
+// Boxes [first, last), N at a time, get -1 in outside[box] when they're
+// outside the frustum and 0 otherwise. Returns the first box left over.
+template <int N>
+SIMD_INLINE int CullBoxesLanes(const Frustum &f, const BoxArrays &boxes, int first, int last, int32_t* outside) {
+    typedef Lanes<N> L;
+    typedef typename L::vi vi;
+    typedef typename L::vf vf;
+
+    int i = first;
+    for (; i + N <= last; i += N) {
+        vf cx, cy, cz, ex, ey, ez;
+        L::Load(cx, &boxes.cx[i], N, N);
+        L::Load(cy, &boxes.cy[i], N, N);
+        L::Load(cz, &boxes.cz[i], N, N);
+        L::Load(ex, &boxes.ex[i], N, N);
+        L::Load(ey, &boxes.ey[i], N, N);
+        L::Load(ez, &boxes.ez[i], N, N);
+
+        // Furthest corner along each normal, the sign bits of the six
+        // distances are merged before the single comparison
+        vi sign = {};
+        for (int p = 0; p < 6; p++) {
+            vf distance = cx * f.a[p] + cy * f.b[p] + cz * f.c[p] + f.d[p]
+                        + ex * fabsf(f.a[p]) + ey * fabsf(f.b[p]) + ez * fabsf(f.c[p]);
+            sign |= (vi) distance;
+        }
+
+        L::Store(outside + i, N, N, (vi) (sign < 0));
+    }
+
+    return i;
+}
+
+// One wrapper per instruction set, the kernel is inlined into them
+inline SIMD_EXACT int CullBoxesScalar(const Frustum &f, const BoxArrays &boxes, int first, int last, int32_t* outside) {
+    return CullBoxesLanes<1>(f, boxes, first, last, outside);
+}
+
+inline SIMD_TARGET("sse2") int CullBoxesSSE2(const Frustum &f, const BoxArrays &boxes, int first, int last, int32_t* outside) {
+    return CullBoxesLanes<4>(f, boxes, first, last, outside);
+}
+
+#ifdef SIMD_X86
+inline SIMD_TARGET("avx2") int CullBoxesAVX2(const Frustum &f, const BoxArrays &boxes, int first, int last, int32_t* outside) {
+    return CullBoxesLanes<8>(f, boxes, first, last, outside);
+}
+
+inline SIMD_TARGET("avx512f") int CullBoxesAVX512(const Frustum &f, const BoxArrays &boxes, int first, int last, int32_t* outside) {
+    return CullBoxesLanes<16>(f, boxes, first, last, outside);
+}
+#endif
+
+// Tests the count boxes from first on, outside holds one value per box of
+// the array. What's left after a kernel's full groups of lanes goes to the
+// narrower ones, so the 8 boxes of a BVH leaf still take one AVX2 step on
+// an AVX-512 machine, down to the scalar kernel for the last few.
+inline void CullBoxes(SimdLevel level, const Frustum &f, const BoxArrays &boxes, int first, int count, int32_t* outside) {
+    int last = first + count;
+
+    switch (level) {
+#ifdef SIMD_X86
+        case SIMD_AVX512: first = CullBoxesAVX512(f, boxes, first, last, outside); [[fallthrough]];
+        case SIMD_AVX2:   first = CullBoxesAVX2(f, boxes, first, last, outside); [[fallthrough]];
+#else
+        case SIMD_AVX512:
+        case SIMD_AVX2:
+#endif
+        case SIMD_SSE2:   first = CullBoxesSSE2(f, boxes, first, last, outside); break;
+        case SIMD_SCALAR: break;
+    }
+
+    CullBoxesScalar(f, boxes, first, last, outside);
+}
+
+#endif
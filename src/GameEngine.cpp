@@ -2,8 +2,11 @@
 #define _GameEngine
 
 #include <SDL2/SDL.h>
+#include <string.h>
+#include <string>
 
 #include "Renderer.cpp"
+#include "ResolutionScaler.cpp"
 
 enum COLOR
 {
@@ -24,9 +27,16 @@ class GameEngine {
         SDL_Renderer* SDL_renderer;
         Renderer renderer;
 
+        std::string sAppName;
+
+        // Scales the framebuffer down when frames take longer to draw than
+        // the scaler's budget, the window shows it scaled back up
+        bool bDynamicResolution;
+        ResolutionScaler resolution;
+
     public:
         GameEngine() {
-
+            bDynamicResolution = false;
         }
 
         virtual bool OnCreate()						                	= 0;
@@ -34,12 +44,26 @@ class GameEngine {
         virtual bool OnKeyReleased(SDL_Keycode kc)	                    = 0;	
         virtual bool OnUpdate(float fElapsedTime)		                = 0;	
 
-        bool CreateWindow(const char* title, int width, int height) {
+        // Extra information shown in the window title with the frame rate
+        virtual std::string OnFrameStats() { return ""; }
+
+        // With frames in flight, frames are shown by a thread of their own
+        // while the next ones are drawn, 0 shows them from this thread. SDL
+        // only supports rendering from the main thread, so the present
+        // thread is only used with the X11 driver, where a renderer works
+        // from the one thread that created it. Elsewhere frames are shown
+        // from this thread whatever framesInFlight is.
+        bool CreateWindow(const char* title, int width, int height, int framesInFlight = 0) {
             if (SDL_Init(SDL_INIT_VIDEO) != 0) {
                 fprintf(stderr,"Échec de l'initialisation de la SDL (%s)\n",SDL_GetError());
                 return -1;
             }
 
+            sAppName = title;
+
+            // Framebuffers scaled down by the dynamic resolution are filtered when scaled back up
+            SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+
             window = SDL_CreateWindow(title,
                                       SDL_WINDOWPOS_UNDEFINED,
                                       SDL_WINDOWPOS_UNDEFINED,
@@ -47,6 +71,15 @@ class GameEngine {
                                       height,
                                       SDL_WINDOW_SHOWN);
 
+            // The present thread creates the SDL renderer and is the only one using it
+            SDL_renderer = NULL;
+            const char* driver = SDL_GetCurrentVideoDriver();
+            if (window && framesInFlight > 0 && driver && strcmp(driver, "x11") == 0) {
+                renderer = Renderer(NULL, width, height);
+                if (renderer.StartPresenter(window, framesInFlight))
+                    return 1;
+            }
+
             if(window) {
                 SDL_renderer = SDL_CreateRenderer(window, -1, 0);
             } else {
@@ -72,6 +105,9 @@ class GameEngine {
             Uint32 lastUpdate = SDL_GetTicks();
             SDL_Event event;
 
+            Uint32 lastTitle = lastUpdate;
+            int nFrames = 0;
+
             while(running) {
                 Uint32 current = SDL_GetTicks();
                 float fElapsedTime = (current - lastUpdate) / 1000.0f;
@@ -90,16 +126,45 @@ class GameEngine {
                     }
                 }
 
+                Uint64 drawStart = SDL_GetPerformanceCounter();
+
                 if (!OnUpdate(fElapsedTime)) {
                     running = false;
                 }
 
-                SDL_RenderPresent(SDL_renderer);
+                renderer.Finish();
+                float fDrawMs = (SDL_GetPerformanceCounter() - drawStart) * 1000.0 / SDL_GetPerformanceFrequency();
+
+                renderer.Present();
                 lastUpdate = current;
+
+                // Size of the next frame, from the time spent drawing this one
+                if (bDynamicResolution) {
+                    float fScale = resolution.Update(fDrawMs);
+                    renderer.SetResolution(renderer.outputWidth * fScale + 0.5f, renderer.outputHeight * fScale + 0.5f);
+                }
+
+                nFrames++;
+                if (current - lastTitle >= 1000) {
+                    std::string sTitle = sAppName + " - FPS: " + std::to_string(nFrames * 1000 / (current - lastTitle));
+                    std::string sStats = OnFrameStats();
+                    if (!sStats.empty())
+                        sTitle += " - " + sStats;
+
+                    if (bDynamicResolution)
+                        sTitle += " - Resolution: " + std::to_string(renderer.width) + "x" + std::to_string(renderer.height)
+                                  + " (" + std::to_string((int) (resolution.scale * 100 + 0.5f)) + "%)";
+
+                    SDL_SetWindowTitle(window, sTitle.c_str());
+                    lastTitle = current;
+                    nFrames = 0;
+                }
             }
 
+            renderer.Destroy();
+            if (SDL_renderer)
+                SDL_DestroyRenderer(SDL_renderer);
             SDL_DestroyWindow(window);
-            SDL_DestroyRenderer(SDL_renderer);
             SDL_Quit();
         }
 };
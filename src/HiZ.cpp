@@ -0,0 +1,122 @@
+#ifndef _HIZ
+#define _HIZ
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+#include "ThreadPool.cpp"
+
+// Pixels covered by a cell of the finest level
+const int HIZ_TILE = 8;
+
+// Hierarchical depth buffer, each level keeps the farthest depth of the
+// cells it covers and is half the size of the one above it. A box whose
+// nearest depth is behind the farthest depth of every cell under it can't
+// pass the depth test anywhere.
+struct HiZBuffer {
+    std::vector<std::vector<float>> levels;
+    std::vector<int> levelWidth;
+    std::vector<int> levelHeight;
+    bool valid;
+
+    HiZBuffer() {
+        valid = false;
+    }
+
+    void Resize(int width, int height) {
+        levels.clear();
+        levelWidth.clear();
+        levelHeight.clear();
+        valid = false;
+
+        int w = (width + HIZ_TILE - 1) / HIZ_TILE;
+        int h = (height + HIZ_TILE - 1) / HIZ_TILE;
+
+        while (true) {
+            levels.push_back(std::vector<float>(w * h));
+            levelWidth.push_back(w);
+            levelHeight.push_back(h);
+
+            if (w == 1 && h == 1)
+                break;
+
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+        }
+    }
+
+    // Builds the pyramid from a depth buffer, rows of cells are spread on the pool
+    template <typename T>
+    void Build(const T* depth, int width, int height, ThreadPool* pool) {
+        if (levels.empty())
+            return;
+
+        std::vector<float> &base = levels[0];
+        int w = levelWidth[0];
+
+        auto buildRow = [&](int cy) {
+            int y0 = cy * HIZ_TILE;
+            int y1 = std::min(height, y0 + HIZ_TILE);
+
+            for (int cx = 0; cx < w; cx++) {
+                int x0 = cx * HIZ_TILE;
+                int x1 = std::min(width, x0 + HIZ_TILE);
+
+                T zmax = depth[y0 * width + x0];
+                for (int y = y0; y < y1; y++)
+                    for (int x = x0; x < x1; x++)
+                        zmax = std::max(zmax, depth[y * width + x]);
+
+                base[cy * w + cx] = zmax;
+            }
+        };
+
+        if (pool)
+            pool->Run(levelHeight[0], buildRow);
+        else
+            for (int cy = 0; cy < levelHeight[0]; cy++)
+                buildRow(cy);
+
+        for (size_t l = 1; l < levels.size(); l++) {
+            const std::vector<float> &src = levels[l - 1];
+            int sw = levelWidth[l - 1], sh = levelHeight[l - 1];
+
+            for (int y = 0; y < levelHeight[l]; y++) {
+                for (int x = 0; x < levelWidth[l]; x++) {
+                    int sx = x * 2, sy = y * 2;
+                    int sx1 = std::min(sx + 1, sw - 1), sy1 = std::min(sy + 1, sh - 1);
+
+                    levels[l][y * levelWidth[l] + x] = std::max(std::max(src[sy * sw + sx], src[sy * sw + sx1]),
+                                                                std::max(src[sy1 * sw + sx], src[sy1 * sw + sx1]));
+                }
+            }
+        }
+
+        valid = true;
+    }
+
+    // Rectangle in pixels, inclusive, and the nearest depth of what it bounds
+    bool IsOccluded(int minX, int minY, int maxX, int maxY, float nearest) const {
+        if (!valid)
+            return false;
+
+        // Coarsest level where the rectangle still covers only a few cells
+        size_t l = 0;
+        int cell = HIZ_TILE;
+        while (l + 1 < levels.size() && (maxX - minX) / cell >= 2 && (maxY - minY) / cell >= 2) {
+            l++;
+            cell *= 2;
+        }
+
+        const std::vector<float> &level = levels[l];
+        for (int y = minY / cell; y <= maxY / cell; y++)
+            for (int x = minX / cell; x <= maxX / cell; x++)
+                if (nearest < level[y * levelWidth[l] + x])
+                    return false;
+
+        return true;
+    }
+};
+
+#endif
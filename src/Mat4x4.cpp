@@ -85,6 +85,32 @@ struct Mat4x4 {
         return mat;
     }
 
+    // Maps the near plane to 1 and the far plane to 0, this spreads float
+    // depth precision evenly instead of piling it up at the near plane
+    static Mat4x4 MakeProjectionReverseZ(float fFovDegrees, float fAspectRatio, float fNear, float fFar) {
+        Mat4x4 mat = MakeProjection(fFovDegrees, fAspectRatio, fNear, fFar);
+
+        mat.m[2][2] = -fNear / (fFar - fNear);
+        mat.m[3][2] = (fFar * fNear) / (fFar - fNear);
+
+        return mat;
+    }
+
+    // Projected x and y in [-1, 1] to pixels, y pointing up, the scale
+    // into view of the projected triangles before the division by w
+    static Mat4x4 MakeScreen(float fWidth, float fHeight) {
+        Mat4x4 mat;
+
+        mat.m[0][0] = 0.5f * fWidth;
+        mat.m[1][1] = 0.5f * fHeight;
+        mat.m[2][2] = 1;
+        mat.m[3][0] = 0.5f * fWidth;
+        mat.m[3][1] = 0.5f * fHeight;
+        mat.m[3][3] = 1;
+
+        return mat;
+    }
+
     static Mat4x4 PointAt(const Vec3d &pos, const Vec3d &target, const Vec3d up) {
         // Calculate new Forward direction
         Vec3d newForward = target - pos;
@@ -145,6 +171,60 @@ struct Mat4x4 {
 		return mat;
 	}
 
+    // Any invertible matrix, projections included. Cofactors from the 2x2
+    // determinants of the two top and two bottom rows, in double as a
+    // projection's entries span orders of magnitude. All zeros if m is singular.
+    static Mat4x4 Inverse(const Mat4x4 &m) {
+        double a[4][4];
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                a[i][j] = m.m[i][j];
+
+        double s0 = a[0][0] * a[1][1] - a[1][0] * a[0][1];
+        double s1 = a[0][0] * a[1][2] - a[1][0] * a[0][2];
+        double s2 = a[0][0] * a[1][3] - a[1][0] * a[0][3];
+        double s3 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+        double s4 = a[0][1] * a[1][3] - a[1][1] * a[0][3];
+        double s5 = a[0][2] * a[1][3] - a[1][2] * a[0][3];
+
+        double c0 = a[2][0] * a[3][1] - a[3][0] * a[2][1];
+        double c1 = a[2][0] * a[3][2] - a[3][0] * a[2][2];
+        double c2 = a[2][0] * a[3][3] - a[3][0] * a[2][3];
+        double c3 = a[2][1] * a[3][2] - a[3][1] * a[2][2];
+        double c4 = a[2][1] * a[3][3] - a[3][1] * a[2][3];
+        double c5 = a[2][2] * a[3][3] - a[3][2] * a[2][3];
+
+        Mat4x4 mat;
+
+        double det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+        if (det == 0)
+            return mat;
+
+        double r = 1.0 / det;
+
+        mat.m[0][0] = ( a[1][1] * c5 - a[1][2] * c4 + a[1][3] * c3) * r;
+        mat.m[0][1] = (-a[0][1] * c5 + a[0][2] * c4 - a[0][3] * c3) * r;
+        mat.m[0][2] = ( a[3][1] * s5 - a[3][2] * s4 + a[3][3] * s3) * r;
+        mat.m[0][3] = (-a[2][1] * s5 + a[2][2] * s4 - a[2][3] * s3) * r;
+
+        mat.m[1][0] = (-a[1][0] * c5 + a[1][2] * c2 - a[1][3] * c1) * r;
+        mat.m[1][1] = ( a[0][0] * c5 - a[0][2] * c2 + a[0][3] * c1) * r;
+        mat.m[1][2] = (-a[3][0] * s5 + a[3][2] * s2 - a[3][3] * s1) * r;
+        mat.m[1][3] = ( a[2][0] * s5 - a[2][2] * s2 + a[2][3] * s1) * r;
+
+        mat.m[2][0] = ( a[1][0] * c4 - a[1][1] * c2 + a[1][3] * c0) * r;
+        mat.m[2][1] = (-a[0][0] * c4 + a[0][1] * c2 - a[0][3] * c0) * r;
+        mat.m[2][2] = ( a[3][0] * s4 - a[3][1] * s2 + a[3][3] * s0) * r;
+        mat.m[2][3] = (-a[2][0] * s4 + a[2][1] * s2 - a[2][3] * s0) * r;
+
+        mat.m[3][0] = (-a[1][0] * c3 + a[1][1] * c1 - a[1][2] * c0) * r;
+        mat.m[3][1] = ( a[0][0] * c3 - a[0][1] * c1 + a[0][2] * c0) * r;
+        mat.m[3][2] = (-a[3][0] * s3 + a[3][1] * s1 - a[3][2] * s0) * r;
+        mat.m[3][3] = ( a[2][0] * s3 - a[2][1] * s1 + a[2][2] * s0) * r;
+
+        return mat;
+    }
+
     Mat4x4 operator *(const Mat4x4& b) const {
         Mat4x4 mat;
 
@@ -167,6 +247,17 @@ struct Mat4x4 {
         return r;
     }
 
+    // Rotates and scales a direction, ignoring the translation
+    Vec3d MultiplyDirection(const Vec3d& b) const {
+        Vec3d r;
+
+        r.x = b.x * m[0][0] + b.y * m[1][0] + b.z * m[2][0];
+        r.y = b.x * m[0][1] + b.y * m[1][1] + b.z * m[2][1];
+        r.z = b.x * m[0][2] + b.y * m[1][2] + b.z * m[2][2];
+
+        return r;
+    }
+
     Triangle operator * (const Triangle& b) const {
         Triangle r;
 
@@ -176,6 +267,14 @@ struct Mat4x4 {
         r.t[1] = b.t[1];
         r.t[2] = b.t[2];
 
+        r.c[0] = b.c[0];
+        r.c[1] = b.c[1];
+        r.c[2] = b.c[2];
+
+        r.n[0] = b.n[0];
+        r.n[1] = b.n[1];
+        r.n[2] = b.n[2];
+
         r.p[0] = *this * b.p[0];
         r.p[1] = *this * b.p[1];
         r.p[2] = *this * b.p[2];
@@ -2,17 +2,781 @@
 #define _MESH
 
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <vector>
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
 
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <sys/stat.h>
 
 #include "Vec3d.cpp"
+#include "Vertex.cpp"
 #include "Triangle.cpp"
+#include "ThreadPool.cpp"
+#include "Frustum.cpp"
+#include "Bvh.cpp"
+#include "Simplify.cpp"
+#include "Optimize.cpp"
 
+// Triangles per batch the renderer culls as a whole
+const int MESH_CHUNK_SIZE = 64;
+
+// Meshes with at least this many triangles compute their normals on all cores
+const int MESH_PARALLEL_NORMALS = 16384;
+
+// Levels of detail under the full mesh, each with about half the
+// triangles of the one before
+const int MESH_LOD_LEVELS = 4;
+
+// Most chunks simplified together, bigger clusters lock fewer edges
+const int MESH_LOD_CHUNKS = 16;
+
+// Vertices closer than this fraction of the mesh's size are welded
+const float MESH_WELD_EPSILON = 1e-5f;
+
+// Triangles put in vertex cache order together, as many as the chunks of
+// a BVH leaf: the chunks are cut from them after, still about as compact
+const int MESH_CACHE_RUN = MESH_CHUNK_SIZE * BVH_LEAF_ITEMS;
+
+// Runs of triangles in vertex cache order are also sorted for overdraw
+const bool MESH_OVERDRAW_ORDER = false;
+
+// A run of consecutive triangles of a mesh, three indices each, and its
+// bounding box and sphere
+struct MeshChunk {
+    uint32_t first;
+    uint32_t count;
+    Vec3d bbMin, bbMax;
+    Vec3d center;
+    float radius;
+
+    // Vertices the chunk's triangles are the first to use, a run of them
+    // once ReorderVertices() numbered them
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+};
+
+// Simplified triangles of a cluster in lodIndices, at most error away from
+// the full mesh in object space
+struct MeshLod {
+    uint32_t first;
+    uint32_t count;
+    float error;
+};
+
+// A subtree of the BVH whose chunks are simplified together. The edges on
+// its boundary aren't touched, so clusters at different levels still meet.
+struct MeshCluster {
+    uint32_t firstChunk;
+    uint32_t chunkCount;
+    Vec3d center;
+    float radius;
+    std::vector<MeshLod> lods;
+};
+
+// Where a ray hit a mesh, t along the ray and the triangle's index
+struct RayHit {
+    float t;
+    uint32_t tri;
+};
+
+// Triangles as indices into vertices shared between them, so each vertex
+// is transformed once however many triangles use it
 struct Mesh {
-    std::vector<Triangle> tris;
+    VertexStreams vertices;
+    std::vector<uint32_t> indices;
+    bool bHasTexture;
+
+    // Object space plane of each triangle, of indices and of lodIndices,
+    // for backface culling before anything is transformed
+    std::vector<Vec3d> planes;
+    std::vector<Vec3d> lodPlanes;
+
+    Mesh() {
+        bHasTexture = false;
+        radius = 0;
+    }
+
+    // Object space bounds of the whole mesh and of its chunks, the chunks'
+    // boxes again laid out for CullBoxes()
+    Vec3d bbMin, bbMax;
+    Vec3d center;
+    float radius;
+    std::vector<MeshChunk> chunks;
+    BoxArrays chunkBoxes;
+
+    // Hierarchy over the chunks, for frustum culling and ray queries
+    Bvh bvh;
+
+    // Levels of detail, the cluster of each chunk and the triangles of all
+    // the levels of all the clusters, indexing the same vertices
+    std::vector<MeshCluster> clusters;
+    std::vector<uint32_t> chunkCluster;
+    std::vector<uint32_t> lodIndices;
+
+    uint32_t TriangleCount() const {
+        return indices.size() / 3;
+    }
+
+    Vec3d Position(uint32_t tri, int corner) const {
+        return vertices.Position(indices[tri * 3 + corner]);
+    }
+
+    // The three vertices of v as a Triangle, for code that doesn't share them
+    Triangle MakeTriangle(const uint32_t* v) const {
+        Triangle tri;
+        for (int i = 0; i < 3; i++) {
+            tri.p[i] = vertices.Position(v[i]);
+            tri.t[i] = vertices.t[v[i]];
+            tri.n[i] = vertices.n[v[i]];
+        }
+
+        return tri;
+    }
+
+    Triangle GetTriangle(uint32_t i) const {
+        return MakeTriangle(&indices[i * 3]);
+    }
+
+    // Sphere around the triangles, centered on their box
+    float BoundingRadius(uint32_t first, uint32_t count, const Vec3d &c) const {
+        float r = 0;
+        for (uint32_t i = first; i < first + count; i++)
+            for (int j = 0; j < 3; j++)
+                r = std::max(r, (Position(i, j) - c).length());
+
+        return r;
+    }
+
+    static void GrowBounds(Vec3d &bbMin, Vec3d &bbMax, const Vec3d &p) {
+        bbMin.x = std::min(bbMin.x, p.x);
+        bbMin.y = std::min(bbMin.y, p.y);
+        bbMin.z = std::min(bbMin.z, p.z);
+        bbMax.x = std::max(bbMax.x, p.x);
+        bbMax.y = std::max(bbMax.y, p.y);
+        bbMax.z = std::max(bbMax.z, p.z);
+    }
+
+    // Spreads the low 10 bits of v so there are two zero bits between each
+    static uint32_t SpreadBits(uint32_t v) {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+
+        return v;
+    }
+
+    // Order of the triangles along a Morton curve of their centers, so the
+    // runs of consecutive triangles making the chunks are compact in space
+    std::vector<uint32_t> SpatialOrder() const {
+        uint32_t count = TriangleCount();
+        if (count == 0)
+            return {};
+
+        Vec3d lo = Position(0, 0), hi = lo;
+        for (uint32_t i = 0; i < indices.size(); i++)
+            GrowBounds(lo, hi, vertices.Position(indices[i]));
+
+        Vec3d size = hi - lo;
+        auto quantize = [](float v, float size) {
+            return size > 0 ? (uint32_t) (v / size * 1023.0f) : 0;
+        };
+
+        std::vector<std::pair<uint32_t, uint32_t>> keys(count);
+        for (uint32_t i = 0; i < count; i++) {
+            Vec3d c = Triangle(Position(i, 0), Position(i, 1), Position(i, 2)).center() - lo;
+            keys[i].first = SpreadBits(quantize(c.x, size.x)) | (SpreadBits(quantize(c.y, size.y)) << 1)
+                          | (SpreadBits(quantize(c.z, size.z)) << 2);
+            keys[i].second = i;
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<uint32_t> order(count);
+        for (uint32_t i = 0; i < count; i++)
+            order[i] = keys[i].second;
+
+        return order;
+    }
+
+    // Triangle i becomes the one at order[i]
+    static void Reorder(std::vector<uint32_t> &indices, const std::vector<uint32_t> &order) {
+        std::vector<uint32_t> sorted(indices.size());
+        for (uint32_t i = 0; i < order.size(); i++)
+            for (int j = 0; j < 3; j++)
+                sorted[i * 3 + j] = indices[order[i] * 3 + j];
+        indices.swap(sorted);
+    }
+
+    void Reorder(const std::vector<uint32_t> &order) {
+        Reorder(indices, order);
+    }
+
+    // Order of a run of triangles for the vertex cache, then for overdraw
+    // around c. Indices are relative to the run, cache is as
+    // OptimizeVertexCache() takes it. A run that misses the cache no less
+    // often that way keeps the order it came in.
+    std::vector<uint32_t> OptimizedOrder(const uint32_t* runIndices, uint32_t count, const Vec3d &c, std::vector<uint32_t> &cache) const {
+        std::vector<uint32_t> order(count), before = cache;
+        OptimizeVertexCache(runIndices, count, order.data(), cache);
+
+        if (MESH_OVERDRAW_ORDER)
+            OptimizeOverdraw(vertices, runIndices, count, c, order.data());
+
+        std::vector<uint32_t> optimized(runIndices, runIndices + count * 3);
+        Reorder(optimized, order);
+
+        if (VertexCacheMissRatio(optimized.data(), count) >= VertexCacheMissRatio(runIndices, count)) {
+            for (uint32_t i = 0; i < count; i++)
+                order[i] = i;
+
+            cache.swap(before);
+            UpdateVertexCache(runIndices, count, cache);
+        }
+
+        return order;
+    }
+
+    // Optimizes runs of MESH_CACHE_RUN triangles along the spatial order,
+    // each starting with the cache the one before left. Returns the new
+    // order of the triangles, as Reorder() takes it.
+    std::vector<uint32_t> OptimizeRuns() {
+        std::vector<uint32_t> order, cache;
+        uint32_t count = TriangleCount();
+
+        Vec3d lo = Position(0, 0), hi = lo;
+        for (uint32_t i : indices)
+            GrowBounds(lo, hi, vertices.Position(i));
+        Vec3d c = (lo + hi) * 0.5f;
+
+        for (uint32_t first = 0; first < count; first += MESH_CACHE_RUN)
+            for (uint32_t i : OptimizedOrder(&indices[first * 3], std::min<uint32_t>(MESH_CACHE_RUN, count - first), c, cache))
+                order.push_back(first + i);
+
+        Reorder(order);
+        return order;
+    }
+
+    // Merges the vertices less than epsilon apart on every axis that have
+    // the same texture coordinates, found through a grid of epsilon sized
+    // cells: a vertex's match is in its cell or one around it.
+    void WeldVertices(float epsilon) {
+        if (vertices.Empty() || epsilon <= 0)
+            return;
+
+        auto cellKey = [](int64_t x, int64_t y, int64_t z) {
+            return ((uint64_t) (x & 0x1fffff) << 42) | ((uint64_t) (y & 0x1fffff) << 21) | (uint64_t) (z & 0x1fffff);
+        };
+
+        std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+        VertexStreams welded;
+        std::vector<uint32_t> remap(vertices.Size());
+
+        for (uint32_t i = 0; i < vertices.Size(); i++) {
+            Vertex v = vertices.Get(i);
+            int64_t x = floorf(v.p.x / epsilon), y = floorf(v.p.y / epsilon), z = floorf(v.p.z / epsilon);
+            int64_t match = -1;
+
+            for (int dz = -1; dz <= 1 && match < 0; dz++) {
+                for (int dy = -1; dy <= 1 && match < 0; dy++) {
+                    for (int dx = -1; dx <= 1 && match < 0; dx++) {
+                        auto cell = cells.find(cellKey(x + dx, y + dy, z + dz));
+                        if (cell == cells.end())
+                            continue;
+
+                        for (uint32_t w : cell->second) {
+                            Vertex other = welded.Get(w);
+                            if (fabsf(other.p.x - v.p.x) <= epsilon && fabsf(other.p.y - v.p.y) <= epsilon &&
+                                fabsf(other.p.z - v.p.z) <= epsilon && other.t.u == v.t.u && other.t.v == v.t.v) {
+                                match = w;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+
+            if (match < 0) {
+                match = welded.Size();
+                welded.Add(v);
+                cells[cellKey(x, y, z)].push_back(match);
+            }
+
+            remap[i] = match;
+        }
+
+        for (uint32_t &i : indices)
+            i = remap[i];
+        std::swap(vertices, welded);
+    }
+
+    // Drops the triangles using a vertex twice, and the ones so flat that
+    // their height is under epsilon
+    void RemoveDegenerates(float epsilon) {
+        std::vector<uint32_t> kept;
+
+        for (uint32_t i = 0; i < TriangleCount(); i++) {
+            const uint32_t* v = &indices[i * 3];
+            if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0])
+                continue;
+
+            Vec3d p0 = Position(i, 0), p1 = Position(i, 1), p2 = Position(i, 2);
+            float longest = std::max({ (p1 - p0).length(), (p2 - p1).length(), (p0 - p2).length() });
+            if ((p1 - p0).cross(p2 - p0).length() <= epsilon * longest)
+                continue;
+
+            kept.insert(kept.end(), v, v + 3);
+        }
+
+        indices.swap(kept);
+    }
+
+    // Vertices in the order the triangles, then the levels of detail, first
+    // use them, so the ones drawn together are fetched together and each
+    // chunk gets a run of them. Vertices no triangle uses are dropped.
+    void ReorderVertices() {
+        std::vector<uint32_t> remap(vertices.Size(), UINT32_MAX);
+        VertexStreams sorted;
+
+        auto renumber = [&](uint32_t* v, uint32_t count) {
+            for (uint32_t i = 0; i < count; i++) {
+                if (remap[v[i]] == UINT32_MAX) {
+                    remap[v[i]] = sorted.Size();
+                    sorted.Add(vertices.Get(v[i]));
+                }
+
+                v[i] = remap[v[i]];
+            }
+        };
+
+        for (auto &chunk : chunks) {
+            chunk.firstVertex = sorted.Size();
+            renumber(&indices[chunk.first * 3], chunk.count * 3);
+            chunk.vertexCount = sorted.Size() - chunk.firstVertex;
+        }
+        renumber(lodIndices.data(), lodIndices.size());
+
+        std::swap(vertices, sorted);
+    }
+
+    void ComputeBounds() {
+        chunks.clear();
+        chunkBoxes.Clear();
+        bbMin = bbMax = Vec3d();
+
+        uint32_t count = TriangleCount();
+        for (uint32_t first = 0; first < count; first += MESH_CHUNK_SIZE) {
+            MeshChunk chunk;
+            chunk.first = first;
+            chunk.count = std::min<uint32_t>(MESH_CHUNK_SIZE, count - first);
+            chunk.firstVertex = chunk.vertexCount = 0;
+            chunk.bbMin = chunk.bbMax = Position(first, 0);
+
+            for (uint32_t i = first; i < first + chunk.count; i++)
+                for (int j = 0; j < 3; j++)
+                    GrowBounds(chunk.bbMin, chunk.bbMax, Position(i, j));
+
+            chunk.center = (chunk.bbMin + chunk.bbMax) * 0.5f;
+            chunk.radius = BoundingRadius(first, chunk.count, chunk.center);
+
+            if (chunks.empty()) {
+                bbMin = chunk.bbMin;
+                bbMax = chunk.bbMax;
+            }
+
+            GrowBounds(bbMin, bbMax, chunk.bbMin);
+            GrowBounds(bbMin, bbMax, chunk.bbMax);
+            chunks.push_back(chunk);
+            chunkBoxes.Add(chunk.bbMin, chunk.bbMax);
+        }
+
+        center = (bbMin + bbMax) * 0.5f;
+        radius = BoundingRadius(0, count, center);
+
+        bvh.Build(chunkBoxes);
+    }
+
+    // Closest triangle the ray hits within tMax, in object space. Both
+    // sides of the triangles count.
+    bool Raycast(const Vec3d &origin, const Vec3d &dir, float tMax, RayHit &hit) const {
+        hit.t = tMax;
+
+        return bvh.Raycast(origin, dir, hit.t, [&](uint32_t first, uint32_t count, float &t) {
+            bool found = false;
+
+            for (uint32_t c = first; c < first + count; c++) {
+                for (uint32_t i = chunks[c].first; i < chunks[c].first + chunks[c].count; i++) {
+                    // Moller-Trumbore
+                    Vec3d p0 = Position(i, 0);
+                    Vec3d e1 = Position(i, 1) - p0;
+                    Vec3d e2 = Position(i, 2) - p0;
+                    Vec3d p = dir.cross(e2);
+
+                    float det = e1.dot(p);
+                    if (det == 0)
+                        continue;
+
+                    float inv = 1.0f / det;
+                    Vec3d s = origin - p0;
+                    float u = s.dot(p) * inv;
+                    if (u < 0 || u > 1)
+                        continue;
+
+                    Vec3d q = s.cross(e1);
+                    float v = dir.dot(q) * inv;
+                    if (v < 0 || u + v > 1)
+                        continue;
+
+                    float d = e2.dot(q) * inv;
+                    if (d >= 0 && d < t) {
+                        t = d;
+                        hit.tri = i;
+                        found = true;
+                    }
+                }
+            }
+
+            return found;
+        });
+    }
+
+    // Order, chunks and BVH of a mesh loaded before, kept next to the model
+    // file. They're only valid for the same file, size and modification
+    // time, and the same chunk and leaf sizes and triangle optimizations.
+    struct CacheHeader {
+        char magic[4];
+        uint32_t chunkSize, leafItems, overdrawOrder;
+        int64_t modelSize, modelTime;
+        uint32_t triCount, chunkCount, nodeCount;
+    };
+
+    static bool ModelStamp(const std::string &sFilename, CacheHeader &header) {
+        struct stat st;
+        if (stat(sFilename.c_str(), &st) != 0)
+            return false;
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "BVH4", 4);
+        header.chunkSize = MESH_CHUNK_SIZE;
+        header.leafItems = BVH_LEAF_ITEMS;
+        header.overdrawOrder = MESH_OVERDRAW_ORDER;
+        header.modelSize = st.st_size;
+        header.modelTime = st.st_mtime;
+
+        return true;
+    }
+
+    template <typename T>
+    static bool ReadArray(std::ifstream &f, std::vector<T> &v, uint32_t count) {
+        v.resize(count);
+        return (bool) f.read((char*) v.data(), count * sizeof(T));
+    }
+
+    template <typename T>
+    static void WriteArray(std::ofstream &f, const std::vector<T> &v) {
+        f.write((const char*) v.data(), v.size() * sizeof(T));
+    }
+
+    // Whether what a cache file holds can be used without reading out of
+    // bounds: order is a permutation of the triangles, the chunks tile
+    // them in order, and every node covers chunks that exist with its
+    // children after it.
+    bool ValidCache(const std::vector<uint32_t> &order, const std::vector<MeshChunk> &cachedChunks,
+                    const std::vector<BvhNode> &nodes) const {
+        std::vector<bool> seen(order.size(), false);
+        for (uint32_t i : order) {
+            if (i >= order.size() || seen[i])
+                return false;
+            seen[i] = true;
+        }
+
+        uint32_t next = 0;
+        for (auto &chunk : cachedChunks) {
+            if (chunk.first != next || chunk.count == 0 || chunk.count > (uint32_t) MESH_CHUNK_SIZE)
+                return false;
+            next += chunk.count;
+        }
+        if (next != order.size())
+            return false;
+
+        for (uint32_t i = 0; i < nodes.size(); i++) {
+            const BvhNode &node = nodes[i];
+            if (node.count == 0 || node.first > cachedChunks.size() || node.count > cachedChunks.size() - node.first)
+                return false;
+
+            if (node.second == 0 ? node.count > (uint32_t) BVH_LEAF_ITEMS
+                                 : node.second <= i + 1 || node.second >= nodes.size())
+                return false;
+        }
+
+        return nodes.empty() == cachedChunks.empty();
+    }
+
+    bool LoadCache(const std::string &sModel) {
+        CacheHeader expected, header;
+        std::ifstream f(sModel + ".bvh", std::ios::binary);
+        if (!f.is_open() || !ModelStamp(sModel, expected) || !f.read((char*) &header, sizeof(header)))
+            return false;
+
+        if (memcmp(header.magic, expected.magic, 4) != 0 || header.chunkSize != expected.chunkSize ||
+            header.leafItems != expected.leafItems || header.overdrawOrder != expected.overdrawOrder ||
+            header.modelSize != expected.modelSize ||
+            header.modelTime != expected.modelTime || header.triCount != TriangleCount())
+            return false;
+
+        // Sizes as ComputeBounds() and Bvh::Build() make them, before
+        // anything is allocated for them
+        uint32_t nChunks = (header.triCount + MESH_CHUNK_SIZE - 1) / MESH_CHUNK_SIZE;
+        if (header.chunkCount != nChunks || header.nodeCount > 2 * nChunks)
+            return false;
+
+        std::vector<uint32_t> order;
+        std::vector<MeshChunk> cachedChunks;
+        std::vector<BvhNode> nodes;
+        Vec3d bounds[3];
+
+        if (!ReadArray(f, order, header.triCount) || !ReadArray(f, cachedChunks, header.chunkCount) ||
+            !ReadArray(f, nodes, header.nodeCount) || !f.read((char*) bounds, sizeof(bounds)) ||
+            !f.read((char*) &radius, sizeof(radius)))
+            return false;
+
+        if (!ValidCache(order, cachedChunks, nodes))
+            return false;
+
+        Reorder(order);
+        chunks.swap(cachedChunks);
+        bvh.nodes.swap(nodes);
+        bbMin = bounds[0];
+        bbMax = bounds[1];
+        center = bounds[2];
+
+        chunkBoxes.Clear();
+        for (auto &chunk : chunks)
+            chunkBoxes.Add(chunk.bbMin, chunk.bbMax);
+
+        return true;
+    }
+
+    // Writing may fail on a read-only directory, the next start rebuilds
+    void SaveCache(const std::string &sModel, const std::vector<uint32_t> &order) const {
+        CacheHeader header;
+        if (!ModelStamp(sModel, header))
+            return;
+
+        header.triCount = TriangleCount();
+        header.chunkCount = chunks.size();
+        header.nodeCount = bvh.nodes.size();
+
+        // Written aside and renamed over the old one, so a start that stops
+        // halfway or runs next to another never leaves half a file
+        std::string sCache = sModel + ".bvh", sTemp = sCache + ".tmp";
+        std::ofstream f(sTemp, std::ios::binary);
+        if (!f.is_open())
+            return;
+
+        Vec3d bounds[3] = { bbMin, bbMax, center };
+        f.write((const char*) &header, sizeof(header));
+        WriteArray(f, order);
+        WriteArray(f, chunks);
+        WriteArray(f, bvh.nodes);
+        f.write((const char*) bounds, sizeof(bounds));
+        f.write((const char*) &radius, sizeof(radius));
+        f.close();
+
+        if (!f || rename(sTemp.c_str(), sCache.c_str()) != 0)
+            remove(sTemp.c_str());
+    }
+
+    // Area weighted normals of the vertices. Vertices at the same position
+    // get the same normal, so texture seams don't show in the lighting:
+    // each sums the face normals around all of them, which lets positions
+    // be done in parallel without sharing anything.
+    void ComputeVertexNormals() {
+        uint32_t nTris = TriangleCount();
+        if (nTris == 0)
+            return;
+
+        std::unique_ptr<ThreadPool> pool;
+        if (nTris >= MESH_PARALLEL_NORMALS)
+            pool.reset(new ThreadPool(std::max(1u, std::thread::hardware_concurrency())));
+
+        // Runs f over [0, count) in batches spread on the pool
+        auto parallelFor = [&](uint32_t count, const std::function<void(uint32_t, uint32_t)> &f) {
+            const uint32_t batch = 4096;
+            int jobs = (count + batch - 1) / batch;
+
+            auto job = [&](int i) { f(i * batch, std::min(count, (i + 1) * batch)); };
+            if (pool)
+                pool->Run(jobs, job);
+            else
+                for (int i = 0; i < jobs; i++)
+                    job(i);
+        };
+
+        // Cross products are twice the triangle's area long, which does the weighting
+        std::vector<Vec3d> faceNormals(nTris);
+        parallelFor(nTris, [&](uint32_t first, uint32_t last) {
+            for (uint32_t i = first; i < last; i++)
+                faceNormals[i] = (Position(i, 1) - Position(i, 0)).cross(Position(i, 2) - Position(i, 0));
+        });
+
+        // Vertices share their triangles, summed one after the other
+        std::vector<Vec3d> sums(vertices.Size());
+        for (uint32_t i = 0; i < indices.size(); i++)
+            sums[indices[i]] += faceNormals[i / 3];
+
+        // Vertices sorted by position, each position is a run of them
+        std::vector<uint32_t> sorted(vertices.Size());
+        for (uint32_t i = 0; i < sorted.size(); i++)
+            sorted[i] = i;
+
+        std::sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) {
+            Vec3d pa = vertices.Position(a), pb = vertices.Position(b);
+            if (pa.x != pb.x) return pa.x < pb.x;
+            if (pa.y != pb.y) return pa.y < pb.y;
+            return pa.z < pb.z;
+        });
+
+        std::vector<uint32_t> positionStart;
+        for (uint32_t i = 0; i < sorted.size(); i++) {
+            Vec3d p = vertices.Position(sorted[i]);
+            if (i == 0 || p.x != vertices.x[sorted[i - 1]] || p.y != vertices.y[sorted[i - 1]] || p.z != vertices.z[sorted[i - 1]])
+                positionStart.push_back(i);
+        }
+        positionStart.push_back(sorted.size());
+
+        parallelFor(positionStart.size() - 1, [&](uint32_t first, uint32_t last) {
+            for (uint32_t v = first; v < last; v++) {
+                Vec3d normal;
+                for (uint32_t i = positionStart[v]; i < positionStart[v + 1]; i++)
+                    normal += sums[sorted[i]];
+
+                normal.normalize();
+
+                for (uint32_t i = positionStart[v]; i < positionStart[v + 1]; i++)
+                    vertices.n[sorted[i]] = normal;
+            }
+        });
+    }
+
+    // Splits the BVH into clusters of at most MESH_LOD_CHUNKS chunks and
+    // simplifies each on its own, in parallel, down to MESH_LOD_LEVELS
+    // levels. A cluster stops early when its locked edges leave too
+    // little to collapse.
+    void GenerateLods() {
+        clusters.clear();
+        lodIndices.clear();
+        chunkCluster.assign(chunks.size(), 0);
+        if (bvh.nodes.empty())
+            return;
+
+        // Highest subtrees that are small enough, in the order of the chunks
+        std::vector<uint32_t> stack = { 0 };
+        while (!stack.empty()) {
+            uint32_t index = stack.back();
+            const BvhNode &node = bvh.nodes[index];
+            stack.pop_back();
+
+            if (node.count > (uint32_t) MESH_LOD_CHUNKS && node.second) {
+                stack.push_back(node.second);
+                stack.push_back(index + 1);
+                continue;
+            }
+
+            MeshCluster cluster;
+            cluster.firstChunk = node.first;
+            cluster.chunkCount = node.count;
+            cluster.center = (node.bbMin + node.bbMax) * 0.5f;
+            cluster.radius = 0;
+
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                cluster.radius = std::max(cluster.radius, (chunks[i].center - cluster.center).length() + chunks[i].radius);
+                chunkCluster[i] = clusters.size();
+            }
+
+            clusters.push_back(cluster);
+        }
+
+        // Clusters share no vertex that moves, each is one job
+        std::vector<std::vector<uint32_t>> levels(clusters.size() * MESH_LOD_LEVELS);
+        std::vector<float> errors(levels.size(), 0);
+
+        auto job = [&](int c) {
+            const MeshChunk &first = chunks[clusters[c].firstChunk];
+            const MeshChunk &last = chunks[clusters[c].firstChunk + clusters[c].chunkCount - 1];
+
+            Simplifier simplifier;
+            simplifier.Setup(vertices, &indices[first.first * 3], last.first + last.count - first.first);
+
+            for (int level = 0; level < MESH_LOD_LEVELS; level++) {
+                uint32_t before = simplifier.triCount;
+                bool reached = simplifier.Simplify(before / 2);
+
+                // Not worth a level for a few triangles less
+                if (simplifier.triCount > before * 3 / 4)
+                    break;
+
+                // Coarser levels are never said to be closer, the selection
+                // takes the coarsest one that's good enough
+                float error = simplifier.Error();
+                if (level > 0)
+                    error = std::max(error, errors[c * MESH_LOD_LEVELS + level - 1]);
+
+                std::vector<uint32_t> &levelIndices = levels[c * MESH_LOD_LEVELS + level];
+                simplifier.Output(levelIndices);
+                std::vector<uint32_t> cache;
+                Reorder(levelIndices, OptimizedOrder(levelIndices.data(), levelIndices.size() / 3, center, cache));
+                errors[c * MESH_LOD_LEVELS + level] = error;
+
+                if (!reached)
+                    break;
+            }
+        };
+
+        std::unique_ptr<ThreadPool> pool;
+        if (clusters.size() > 1)
+            pool.reset(new ThreadPool(std::max(1u, std::thread::hardware_concurrency())));
+
+        if (pool)
+            pool->Run(clusters.size(), job);
+        else
+            job(0);
+
+        for (uint32_t c = 0; c < clusters.size(); c++) {
+            for (int level = 0; level < MESH_LOD_LEVELS; level++) {
+                const std::vector<uint32_t> &levelIndices = levels[c * MESH_LOD_LEVELS + level];
+                if (levelIndices.empty())
+                    break;
+
+                clusters[c].lods.push_back({ (uint32_t) lodIndices.size() / 3, (uint32_t) levelIndices.size() / 3, errors[c * MESH_LOD_LEVELS + level] });
+                lodIndices.insert(lodIndices.end(), levelIndices.begin(), levelIndices.end());
+            }
+        }
+    }
+
+    void ComputePlanes() {
+        planes.resize(TriangleCount());
+        for (uint32_t i = 0; i < planes.size(); i++)
+            planes[i] = MakeTriangle(&indices[i * 3]).plane();
+
+        lodPlanes.resize(lodIndices.size() / 3);
+        for (uint32_t i = 0; i < lodPlanes.size(); i++)
+            lodPlanes[i] = MakeTriangle(&lodIndices[i * 3]).plane();
+    }
+
+    // Texture coordinates projected from above, for meshes that have none
+    void GeneratePlanarUVs(float fScale) {
+        for (uint32_t i = 0; i < vertices.Size(); i++)
+            vertices.t[i] = Vec2d(vertices.x[i] / fScale, vertices.z[i] / fScale);
+
+        bHasTexture = true;
+    }
 
     bool LoadFromObjectFile(std::string sFilename) {
         std::ifstream f(sFilename);
@@ -21,6 +785,11 @@ struct Mesh {
 
         // Local cache of verts
         std::vector<Vec3d> verts;
+        std::vector<Vec2d> texs;
+
+        // Mesh vertex of each pair of position and texture coordinates, the
+        // texture index is 0 for none
+        std::unordered_map<uint64_t, uint32_t> vertexIndex;
 
         while (!f.eof()) {
             char line[128];
@@ -31,19 +800,92 @@ struct Mesh {
 
             char junk;
             
-            if (line[0] == 'v') {
+            if (line[0] == 'v' && line[1] == ' ') {
                 Vec3d v;
                 s >> junk >> v.x >> v.y >> v.z;
                 verts.push_back(v);
             }
 
+            // OBJ's v goes up, textures have their first row at the top
+            if (line[0] == 'v' && line[1] == 't') {
+                Vec2d t;
+                s >> junk >> junk >> t.u >> t.v;
+                t.v = 1 - t.v;
+                texs.push_back(t);
+            }
+
+            // Vertices are "v", "v/vt", "v//vn" or "v/vt/vn"
             if (line[0] == 'f') {
-                int f[3];
-                s >> junk >> f[0] >> f[1] >> f[2];
-                tris.push_back( { verts[f[0] - 1], verts [f[1] - 1], verts[f[2] - 1] });
+                std::string token[3];
+                s >> junk >> token[0] >> token[1] >> token[2];
+
+                bool textured = true;
+                for (int i = 0; i < 3; i++) {
+                    int v = 0, t = 0;
+                    if (sscanf(token[i].c_str(), "%d/%d", &v, &t) < 2 || t < 1 || t > (int) texs.size())
+                        textured = false;
+                    if (!textured)
+                        t = 0;
+
+                    uint64_t key = ((uint64_t) v << 32) | (uint32_t) t;
+                    auto found = vertexIndex.find(key);
+                    if (found == vertexIndex.end()) {
+                        Vertex vertex;
+                        vertex.p = verts[v - 1];
+                        if (textured)
+                            vertex.t = texs[t - 1];
+
+                        found = vertexIndex.insert({ key, vertices.Size() }).first;
+                        vertices.Add(vertex);
+                    }
+
+                    indices.push_back(found->second);
+                }
+
+                bHasTexture |= textured;
             }
         }
 
+        uint32_t nLoadedVertices = vertices.Size(), nLoadedTris = TriangleCount();
+        float fLoadedAcmr = VertexCacheMissRatio(indices.data(), nLoadedTris);
+        size_t nLoadedBytes = vertices.Size() * VertexStreams::VertexSize() + indices.size() * sizeof(uint32_t);
+
+        // Duplicated positions and triangles with no area, before anything
+        // depends on the number of triangles
+        if (!vertices.Empty()) {
+            Vec3d lo = vertices.Position(0), hi = lo;
+            for (uint32_t i = 0; i < vertices.Size(); i++)
+                GrowBounds(lo, hi, vertices.Position(i));
+
+            float epsilon = MESH_WELD_EPSILON * (hi - lo).length();
+            WeldVertices(epsilon);
+            RemoveDegenerates(epsilon);
+        }
+
+        // The spatial order refined for the vertex cache, and the chunks
+        // and hierarchy over it, built at the first load
+        if (!LoadCache(sFilename) && !indices.empty()) {
+            std::vector<uint32_t> order = SpatialOrder();
+            Reorder(order);
+
+            std::vector<uint32_t> runOrder = OptimizeRuns();
+            for (uint32_t &i : runOrder)
+                i = order[i];
+
+            ComputeBounds();
+            SaveCache(sFilename, runOrder);
+        }
+
+        ComputeVertexNormals();
+        GenerateLods();
+        ReorderVertices();
+        ComputePlanes();
+
+        printf("%s: %u -> %u vertices, %u -> %u triangles, ACMR %.3f -> %.3f, %.1f -> %.1f KB\n", sFilename.c_str(),
+               nLoadedVertices, vertices.Size(), nLoadedTris, TriangleCount(),
+               fLoadedAcmr, VertexCacheMissRatio(indices.data(), TriangleCount()),
+               nLoadedBytes / 1024.0, (vertices.Size() * VertexStreams::VertexSize() + indices.size() * sizeof(uint32_t)) / 1024.0);
+
         return 1;
     }
 };
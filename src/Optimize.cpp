@@ -0,0 +1,256 @@
+#ifndef _OPTIMIZE
+#define _OPTIMIZE
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "Vec3d.cpp"
+#include "Vertex.cpp"
+
+// Entries of the vertex cache the triangle orders are made for, and
+// that ACMR is measured with
+const int VERTEX_CACHE_SIZE = 32;
+
+// FIFO of the last vertices transformed, as a GPU's post-transform cache
+struct VertexFifo {
+    std::vector<uint32_t> entries;
+    size_t next;
+
+    VertexFifo(int size) : entries(size, UINT32_MAX), next(0) {}
+
+    // Whether v had to be transformed, it's in the cache after that
+    bool Miss(uint32_t v) {
+        if (std::find(entries.begin(), entries.end(), v) != entries.end())
+            return false;
+
+        entries[next] = v;
+        next = (next + 1) % entries.size();
+        return true;
+    }
+};
+
+// Average cache miss ratio, vertices transformed per triangle: 3 without
+// any reuse, 0.5 at best on a large regular grid
+inline float VertexCacheMissRatio(const uint32_t* indices, uint32_t count, int cacheSize = VERTEX_CACHE_SIZE) {
+    if (count == 0)
+        return 0;
+
+    VertexFifo fifo(cacheSize);
+    uint32_t misses = 0;
+    for (uint32_t i = 0; i < count * 3; i++)
+        misses += fifo.Miss(indices[i]);
+
+    return (float) misses / count;
+}
+
+// Tom Forsyth's linear-speed vertex cache optimisation: triangles are
+// taken greedily by the scores of their vertices, high for the ones
+// recently used and for the ones with few triangles left. Writes the
+// order of the run's count triangles into order. cache holds the vertices
+// left in the cache by the run drawn before, most recent first, and gets
+// the ones this run leaves.
+inline void OptimizeVertexCache(const uint32_t* indices, uint32_t count, uint32_t* order, std::vector<uint32_t> &cache) {
+    const int cacheSize = VERTEX_CACHE_SIZE;
+
+    // Vertices of the run numbered from 0
+    std::vector<uint32_t> unique(indices, indices + count * 3);
+    std::sort(unique.begin(), unique.end());
+    unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+
+    std::vector<uint32_t> local(count * 3);
+    for (uint32_t i = 0; i < count * 3; i++)
+        local[i] = std::lower_bound(unique.begin(), unique.end(), indices[i]) - unique.begin();
+
+    // Triangles not yet taken around each vertex
+    uint32_t nVertices = unique.size();
+    std::vector<uint32_t> remaining(nVertices, 0), first(nVertices + 1, 0), tris(count * 3);
+    for (uint32_t i = 0; i < count * 3; i++)
+        remaining[local[i]]++;
+    for (uint32_t v = 0; v < nVertices; v++)
+        first[v + 1] = first[v] + remaining[v];
+
+    std::vector<uint32_t> filled(first.begin(), first.end() - 1);
+    for (uint32_t i = 0; i < count * 3; i++)
+        tris[filled[local[i]]++] = i / 3;
+
+    auto vertexScore = [&](int position, uint32_t left) {
+        if (left == 0)
+            return -1.0f;
+
+        // The last triangle's vertices score the same whichever order they came in
+        float score = 0;
+        if (position >= 0)
+            score = position < 3 ? 0.75f : powf(1 - (position - 3) / (float) (cacheSize - 3), 1.5f);
+
+        return score + 2.0f / sqrtf(left);
+    };
+
+    // Vertices of the run still in the cache from before
+    std::vector<uint32_t> runCache, next;
+    std::vector<int> position(nVertices, -1);
+    for (uint32_t v : cache) {
+        auto found = std::lower_bound(unique.begin(), unique.end(), v);
+        if (found != unique.end() && *found == v && runCache.size() < (size_t) cacheSize) {
+            position[found - unique.begin()] = runCache.size();
+            runCache.push_back(found - unique.begin());
+        }
+    }
+
+    std::vector<float> vertexScores(nVertices), triScores(count, 0);
+    std::vector<bool> taken(count, false);
+    for (uint32_t v = 0; v < nVertices; v++)
+        vertexScores[v] = vertexScore(position[v], remaining[v]);
+    for (uint32_t t = 0; t < count; t++)
+        for (int j = 0; j < 3; j++)
+            triScores[t] += vertexScores[local[t * 3 + j]];
+
+    int64_t best = -1;
+
+    for (uint32_t n = 0; n < count; n++) {
+        // Nothing left around the cache, the best triangle anywhere
+        if (best < 0) {
+            for (uint32_t t = 0; t < count; t++)
+                if (!taken[t] && (best < 0 || triScores[t] > triScores[best]))
+                    best = t;
+        }
+
+        order[n] = best;
+        taken[best] = true;
+
+        // Its vertices to the front of the cache, the others pushed back
+        next.clear();
+        for (int j = 0; j < 3; j++) {
+            uint32_t v = local[best * 3 + j];
+            if (std::find(next.begin(), next.end(), v) != next.end())
+                continue;
+
+            next.push_back(v);
+            for (uint32_t i = first[v]; i < first[v] + remaining[v]; i++) {
+                if (tris[i] == best) {
+                    std::swap(tris[i], tris[first[v] + remaining[v] - 1]);
+                    remaining[v]--;
+                    break;
+                }
+            }
+        }
+        for (uint32_t v : runCache)
+            if (std::find(next.begin(), next.end(), v) == next.end())
+                next.push_back(v);
+
+        // Vertices falling out of the cache score without it
+        for (size_t i = cacheSize; i < next.size(); i++)
+            position[next[i]] = -1;
+        if (next.size() > (size_t) cacheSize)
+            next.resize(cacheSize);
+        runCache.swap(next);
+
+        for (size_t i = 0; i < runCache.size(); i++)
+            position[runCache[i]] = i;
+
+        // Scores changed for the vertices in the cache and the ones that
+        // left it, the triangles left around the cache get theirs again
+        auto rescore = [&](uint32_t v) {
+            float score = vertexScore(position[v], remaining[v]);
+            float delta = score - vertexScores[v];
+            vertexScores[v] = score;
+
+            for (uint32_t i = first[v]; i < first[v] + remaining[v]; i++)
+                triScores[tris[i]] += delta;
+        };
+        for (uint32_t v : next)
+            if (position[v] < 0)
+                rescore(v);
+        for (uint32_t v : runCache)
+            rescore(v);
+
+        best = -1;
+        for (uint32_t v : runCache)
+            for (uint32_t i = first[v]; i < first[v] + remaining[v]; i++)
+                if (!taken[tris[i]] && (best < 0 || triScores[tris[i]] > triScores[best]))
+                    best = tris[i];
+    }
+
+    // The run's vertices in front of what's left from before
+    next.clear();
+    for (uint32_t v : runCache)
+        next.push_back(unique[v]);
+    for (uint32_t v : cache)
+        if (next.size() < (size_t) cacheSize && !std::binary_search(unique.begin(), unique.end(), v))
+            next.push_back(v);
+    cache.swap(next);
+}
+
+// The cache after drawing count triangles in their order, from the one
+// left before: the vertices used last first, as OptimizeVertexCache()
+// leaves it
+inline void UpdateVertexCache(const uint32_t* indices, uint32_t count, std::vector<uint32_t> &cache) {
+    std::vector<uint32_t> next;
+    for (uint32_t i = count * 3; i-- > 0 && next.size() < (size_t) VERTEX_CACHE_SIZE; )
+        if (std::find(next.begin(), next.end(), indices[i]) == next.end())
+            next.push_back(indices[i]);
+
+    for (uint32_t v : cache)
+        if (next.size() < (size_t) VERTEX_CACHE_SIZE && std::find(next.begin(), next.end(), v) == next.end())
+            next.push_back(v);
+
+    cache.swap(next);
+}
+
+// Splits a run already in vertex cache order where the cache runs dry,
+// and puts the clusters facing away from the center first: on a mostly
+// convex mesh those are the ones in front, drawn before what they hide.
+// Each cluster keeps its order, so the cache does about as well.
+inline void OptimizeOverdraw(const VertexStreams &vertices, const uint32_t* indices, uint32_t count, const Vec3d &center, uint32_t* order) {
+    std::vector<uint32_t> starts;
+    VertexFifo fifo(VERTEX_CACHE_SIZE);
+
+    for (uint32_t n = 0; n < count; n++) {
+        const uint32_t* v = &indices[order[n] * 3];
+        int misses = fifo.Miss(v[0]) + fifo.Miss(v[1]) + fifo.Miss(v[2]);
+
+        if (n == 0 || misses == 3)
+            starts.push_back(n);
+    }
+    starts.push_back(count);
+
+    if (starts.size() <= 2)
+        return;
+
+    // How much a cluster faces away from the center, from its area
+    // weighted centroid and normal
+    std::vector<std::pair<float, uint32_t>> clusters;
+    for (uint32_t c = 0; c + 1 < starts.size(); c++) {
+        Vec3d centroid, normal;
+        float area = 0;
+
+        for (uint32_t n = starts[c]; n < starts[c + 1]; n++) {
+            const uint32_t* v = &indices[order[n] * 3];
+            Vec3d p0 = vertices.Position(v[0]), p1 = vertices.Position(v[1]), p2 = vertices.Position(v[2]);
+
+            Vec3d cross = (p1 - p0).cross(p2 - p0);
+            float a = cross.length();
+
+            centroid += (p0 + p1 + p2) * (a / 3);
+            normal += cross;
+            area += a;
+        }
+
+        if (area > 0)
+            centroid = centroid * (1 / area);
+
+        float facing = (centroid - center).dot(normal.normalized());
+        clusters.push_back({ -facing, c });
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const std::pair<float, uint32_t> &a, const std::pair<float, uint32_t> &b) {
+        return a.first < b.first;
+    });
+
+    std::vector<uint32_t> sorted;
+    for (auto &cluster : clusters)
+        sorted.insert(sorted.end(), order + starts[cluster.second], order + starts[cluster.second + 1]);
+    std::copy(sorted.begin(), sorted.end(), order);
+}
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef _PRESENTER
+#define _PRESENTER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <SDL2/SDL.h>
+
+// Copies a frame of 0x00RRGGBB pixels into the top left corner of a
+// streaming texture, which may be bigger
+inline void UploadFrame(SDL_Texture* texture, const uint32_t* pixels, int width, int height) {
+    SDL_Rect rect = { 0, 0, width, height };
+    void* dst;
+    int pitch;
+
+    if (SDL_LockTexture(texture, &rect, &dst, &pitch) == 0) {
+        if (pitch == width * (int) sizeof(uint32_t)) {
+            memcpy(dst, pixels, width * height * sizeof(uint32_t));
+        } else {
+            for (int y = 0; y < height; y++)
+                memcpy((uint8_t*) dst + y * pitch, &pixels[y * width], width * sizeof(uint32_t));
+        }
+        SDL_UnlockTexture(texture);
+    } else {
+        SDL_UpdateTexture(texture, &rect, pixels, width * sizeof(uint32_t));
+    }
+}
+
+// Frame waiting to be shown, smaller than the output when the resolution
+// is scaled down
+struct PresentFrame {
+    std::vector<uint32_t> pixels;
+    int width, height;
+};
+
+// Shows frames from its own thread, so the upload and the vsync wait of a
+// frame overlap with drawing the next ones. SDL wants its renderer used
+// from one thread, this one creates it and is the only one to touch it.
+// SDL2 only supports that thread being the main one: this works with X11,
+// not on macOS and not reliably with Direct3D or some OpenGL drivers, so
+// GameEngine::CreateWindow() only starts it under X11.
+//
+// Frames wait in a ring of framesInFlight framebuffers, the one being drawn
+// is the renderer's own. The handoff only needs the two counters, the
+// mutex is there for sleeping when the ring is full or empty and is only
+// taken when a thread sleeps.
+struct Presenter {
+    std::thread thread;
+    SDL_Window* window;
+    int width, height;
+
+    std::vector<PresentFrame> ring;
+    std::atomic<uint32_t> submitted;
+    std::atomic<uint32_t> presented;
+
+    std::atomic<int> sleepers;
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    // 0 while the thread starts, 1 when it runs, -1 if it couldn't create
+    // its renderer
+    std::atomic<int> state;
+    std::atomic<bool> quit;
+
+    Presenter() {
+        window = NULL;
+        width = height = 0;
+        submitted = 0;
+        presented = 0;
+        sleepers = 0;
+        state = 0;
+        quit = false;
+    }
+
+    ~Presenter() {
+        Stop();
+    }
+
+    // Frames are scaled up to the output size. Returns false if the thread
+    // couldn't create an SDL renderer for the window.
+    bool Start(SDL_Window* w, int outputWidth, int outputHeight, int framesInFlight) {
+        window = w;
+        width = outputWidth;
+        height = outputHeight;
+        ring.assign(std::max(1, framesInFlight), { std::vector<uint32_t>(width * height, 0), width, height });
+
+        thread = std::thread([this] { Run(); });
+        Wait([this] { return state != 0; });
+
+        if (state < 0) {
+            thread.join();
+            return false;
+        }
+
+        return true;
+    }
+
+    void Stop() {
+        if (!thread.joinable())
+            return;
+
+        quit = true;
+        Notify();
+        thread.join();
+    }
+
+    // Hands the frame over, swapping it with a free framebuffer of the ring
+    // that may be of another size. Waits while the ring is full.
+    void Submit(std::vector<uint32_t> &frame, int frameWidth, int frameHeight) {
+        uint32_t n = submitted.load(std::memory_order_relaxed);
+        Wait([&] { return n - presented.load(std::memory_order_acquire) < ring.size(); });
+
+        PresentFrame &slot = ring[n % ring.size()];
+        slot.pixels.swap(frame);
+        slot.width = frameWidth;
+        slot.height = frameHeight;
+        submitted.store(n + 1, std::memory_order_release);
+        Notify();
+    }
+
+    // Sleeping and waking up. With a full fence on both sides, a thread
+    // going to sleep either sees the new counter or gets notified.
+    template <typename F>
+    void Wait(F ready) {
+        if (ready())
+            return;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        sleepers++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wake.wait(lock, ready);
+        sleepers--;
+    }
+
+    void Notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load() == 0)
+            return;
+
+        { std::lock_guard<std::mutex> lock(mutex); }
+        wake.notify_all();
+    }
+
+    void Run() {
+        SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, 0);
+        SDL_Texture* texture = NULL;
+
+        if (renderer)
+            texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, width, height);
+
+        if (!texture) {
+            fprintf(stderr,"Erreur de création du moteur de rendu: %s\n",SDL_GetError());
+            if (renderer)
+                SDL_DestroyRenderer(renderer);
+
+            state = -1;
+            Notify();
+            return;
+        }
+
+        state = 1;
+        Notify();
+
+        while (true) {
+            uint32_t n = presented.load(std::memory_order_relaxed);
+            Wait([&] { return quit || submitted.load(std::memory_order_acquire) != n; });
+
+            if (submitted.load(std::memory_order_acquire) == n)
+                break;
+
+            // The framebuffer is free again once it's in the texture, before
+            // the possibly long wait for vsync
+            const PresentFrame &frame = ring[n % ring.size()];
+            SDL_Rect source = { 0, 0, frame.width, frame.height };
+
+            UploadFrame(texture, frame.pixels.data(), frame.width, frame.height);
+            presented.store(n + 1, std::memory_order_release);
+            Notify();
+
+            SDL_RenderCopy(renderer, texture, &source, NULL);
+            SDL_RenderPresent(renderer);
+        }
+
+        SDL_DestroyTexture(texture);
+        SDL_DestroyRenderer(renderer);
+    }
+};
+
+#endif
@@ -0,0 +1,664 @@
+#ifndef _RASTERIZER
+#define _RASTERIZER
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+#include "Simd.cpp"
+#include "Texture.cpp"
+
+// Per-pixel depth buffer storage
+enum DepthMode {
+    DEPTH_NONE,             // No depth buffer, triangles must be sorted back to front
+    DEPTH_16,               // 16-bit fixed point depth
+    DEPTH_32F,              // 32-bit float depth
+};
+
+// How a triangle gets its color
+enum ShadeMode {
+    SHADE_FLAT,             // Triangle::col
+    SHADE_SMOOTH,           // Triangle::c interpolated across the triangle
+    SHADE_TEXTURED,         // Texture lit by Triangle::col, perspective correct
+};
+
+// Screen space plane v = v0 + a * (x - x0) + b * (y - y0), used to
+// interpolate depth and colors across a triangle
+struct ScreenPlane {
+    float x0, y0, v0;
+    float a, b;
+
+    float Row(int y) const {
+        return v0 + b * ((float) y - y0);
+    }
+
+    float At(float vRow, int x) const {
+        return vRow + a * ((float) x - x0);
+    }
+};
+
+// Vertex colors along the scanline rasterizer's spans. The three channels
+// are kept in 16.16 fixed point in one vector, so moving to the next pixel
+// is a single vector add. The value at (x, y) is exact integer math on the
+// plane's origin and steps, so spans give the same colors however they're
+// split. Unsigned, the origin often doesn't fit in 32 bits but the
+// wrapping cancels out inside the triangle.
+struct SpanColors {
+    typedef uint32_t v4 __attribute__((vector_size(16)));
+    typedef int32_t s4 __attribute__((vector_size(16)));
+
+    v4 origin, step, stepY;
+
+    static uint32_t Fixed(double v) {
+        return (uint32_t) (int64_t) (v * 65536.0);
+    }
+
+    // Rounded when they're shifted back to integers
+    void Setup(const ScreenPlane &red, const ScreenPlane &green, const ScreenPlane &blue) {
+        const ScreenPlane* planes[3] = { &red, &green, &blue };
+
+        origin = step = stepY = (v4) {};
+        for (int i = 0; i < 3; i++) {
+            const ScreenPlane &p = *planes[i];
+
+            origin[i] = Fixed((double) p.v0 - (double) p.a * p.x0 - (double) p.b * p.y0) + 0x8000;
+            step[i] = Fixed(p.a);
+            stepY[i] = Fixed(p.b);
+        }
+    }
+
+    v4 At(int x, int y) const {
+        return origin + step * (uint32_t) x + stepY * (uint32_t) y;
+    }
+
+    // Integer channels clamped to [0, 255] with masks, values over 255 turn into -1 first
+    static s4 Clamp(const v4 &c) {
+        s4 i = (s4) c >> 16;
+        i &= ~(i >> 31);
+        i |= (255 - i) >> 31;
+
+        return i & 0xff;
+    }
+
+    static uint32_t Pack(const v4 &c) {
+        s4 i = Clamp(c);
+        return (i[0] << 16) | (i[1] << 8) | i[2];
+    }
+
+    // Fills n pixels starting with the channels c, four at a time with a
+    // vector per channel. Gives the same values as stepping one pixel at a
+    // time. Channels are linear, if both ends are in range so is the rest and
+    // clamping can be skipped.
+    void Fill(uint32_t* dst, int n, v4 c) const {
+        uint32_t sr = step[0], sg = step[1], sb = step[2];
+        v4 r = (v4) { 0, sr, 2 * sr, 3 * sr } + c[0];
+        v4 g = (v4) { 0, sg, 2 * sg, 3 * sg } + c[1];
+        v4 b = (v4) { 0, sb, 2 * sb, 3 * sb } + c[2];
+        v4 dr = (v4) {} + 4 * sr, dg = (v4) {} + 4 * sg, db = (v4) {} + 4 * sb;
+
+        v4 last = c + step * (uint32_t) (n - 1);
+        v4 outside = (c | last) & ~0xffffffu;
+        bool inRange = (outside[0] | outside[1] | outside[2]) == 0;
+
+        int i = 0;
+        if (inRange) {
+            for (; i + 4 <= n; i += 4) {
+                v4 col = (r & 0xff0000) | ((g >> 8) & 0xff00) | (b >> 16);
+                memcpy(dst + i, &col, sizeof(col));
+
+                r += dr;
+                g += dg;
+                b += db;
+            }
+        } else {
+            for (; i + 4 <= n; i += 4) {
+                s4 col = (Clamp(r) << 16) | (Clamp(g) << 8) | Clamp(b);
+                memcpy(dst + i, &col, sizeof(col));
+
+                r += dr;
+                g += dg;
+                b += db;
+            }
+        }
+
+        c += step * (uint32_t) i;
+        for (; i < n; i++) {
+            dst[i] = Pack(c);
+            c += step;
+        }
+    }
+};
+
+// Encoded depth to the value kept in the depth buffer
+template <typename T>
+inline T StoreDepth(float z);
+
+template <>
+inline float StoreDepth<float>(float z) {
+    return z;
+}
+
+template <>
+inline uint16_t StoreDepth<uint16_t>(float z) {
+    if (z <= 0) return 0;
+    if (z >= 65535) return 65535;
+    return (uint16_t) (z + 0.5f);
+}
+
+// Size of the blocks the edge function rasterizer accepts or rejects at once
+const int EDGE_BLOCK = 8;
+
+// Triangle ready for the edge function rasterizer, every pixel with
+// E(x, y) = A * (x - ox) + B * (y - oy) + C >= 0 for the three edges is
+// inside. Keeping the origin next to the triangle keeps E in 32 bits.
+struct EdgeSetup {
+    int A[3], B[3], C[3];
+    int ox, oy;
+
+    // Bounding box, already clipped to the scissor
+    int minX, minY, maxX, maxY;
+
+    ScreenPlane depth;
+    ScreenPlane red, green, blue;
+    uint32_t col;
+
+    // u / w, v / w and 1 / w, the range of 1 / w over the triangle keeps
+    // the block corners extrapolated by the affine subdivision sensible
+    ScreenPlane u, v, w;
+    float wMin, wMax;
+
+    const MipLevel* mip;
+    TextureFilter filter;
+    bool subdivide;
+};
+
+// Texture coordinates at the corners of an edge block, (0, 0), (B, 0),
+// (0, B) and (B, B). The affine subdivision divides there and interpolates
+// in between instead of dividing at each pixel.
+struct EdgeBlockUV {
+    float u[4], v[4];
+};
+
+// Buffers the rasterizers write to and the scissor rectangle, inclusive.
+// When overdraw isn't NULL it counts the triangles covering each pixel.
+struct RasterBuffers {
+    uint32_t* pixels;
+    void* depth;
+    uint16_t* overdraw;
+    int width, height;
+    int clipX0, clipY0, clipX1, clipY1;
+};
+
+// Value of a plane at N pixels
+template <int N>
+SIMD_INLINE void PlaneLanes(typename Lanes<N>::vf &v, const ScreenPlane &p,
+                            const typename Lanes<N>::vf &fx, const typename Lanes<N>::vf &fy) {
+    v = (p.v0 + p.b * (fy - p.y0)) + p.a * (fx - p.x0);
+}
+
+template <int N>
+SIMD_INLINE void ChannelLanes(typename Lanes<N>::vi &c, const ScreenPlane &p,
+                              const typename Lanes<N>::vf &fx, const typename Lanes<N>::vf &fy) {
+    typename Lanes<N>::vf v;
+    PlaneLanes<N>(v, p, fx, fy);
+    Lanes<N>::Clamp(v, 0.0f, 255.0f);
+    c = __builtin_convertvector(v + 0.5f, typename Lanes<N>::vi);
+}
+
+// Texture coordinates of a pixel, with one division
+SIMD_INLINE void PerspectiveUV(const EdgeSetup &s, float x, float y, float &u, float &v) {
+    float w = s.w.v0 + s.w.b * (y - s.w.y0) + s.w.a * (x - s.w.x0);
+    float q = 1.0f / std::min(s.wMax, std::max(s.wMin, w));
+
+    u = (s.u.v0 + s.u.b * (y - s.u.y0) + s.u.a * (x - s.u.x0)) * q;
+    v = (s.v.v0 + s.v.b * (y - s.v.y0) + s.v.a * (x - s.v.x0)) * q;
+}
+
+SIMD_INLINE void BlockUV(const EdgeSetup &s, int bx, int by, EdgeBlockUV &uv) {
+    for (int i = 0; i < 4; i++)
+        PerspectiveUV(s, bx + (i & 1) * EDGE_BLOCK, by + (i >> 1) * EDGE_BLOCK, uv.u[i], uv.v[i]);
+}
+
+// Rounds towards minus infinity, truncating and fixing negative values
+template <int N>
+SIMD_INLINE void FloorLanes(typename Lanes<N>::vi &r, const typename Lanes<N>::vf &v) {
+    r = __builtin_convertvector(v, typename Lanes<N>::vi);
+    r += __builtin_convertvector(r, typename Lanes<N>::vf) > v;
+}
+
+// Blends texels with weights out of 256, like LerpTexel()
+template <int N>
+SIMD_INLINE void LerpTexelLanes(typename Lanes<N>::vu &r, const typename Lanes<N>::vu &a,
+                                const typename Lanes<N>::vu &b, const typename Lanes<N>::vu &t) {
+    typename Lanes<N>::vu rb = ((a & 0xff00ff) * (256 - t) + (b & 0xff00ff) * t) >> 8;
+    typename Lanes<N>::vu g  = ((a & 0x00ff00) * (256 - t) + (b & 0x00ff00) * t) >> 8;
+
+    r = (rb & 0xff00ff) | (g & 0x00ff00);
+}
+
+template <int N>
+SIMD_INLINE void GatherTexels(typename Lanes<N>::vu &r, const MipLevel &mip,
+                              const typename Lanes<N>::vi &x, const typename Lanes<N>::vi &y) {
+    typedef Lanes<N> L;
+
+    typename L::vi index = (((y >> 2) * mip.tilesX + (x >> 2)) << 4)
+                         | (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2);
+
+    int32_t idx[L::M];
+    uint32_t texels[L::M] = {};
+    memcpy(idx, &index, sizeof(index));
+
+    for (int i = 0; i < N; i++)
+        texels[i] = mip.texels[idx[i]];
+
+    memcpy(&r, texels, sizeof(r));
+}
+
+// Samples N texels at wrapping coordinates, same results as Texture::Sample()
+template <int N>
+SIMD_INLINE void SampleLanes(typename Lanes<N>::vu &r, const MipLevel &mip, TextureFilter filter,
+                             const typename Lanes<N>::vf &u, const typename Lanes<N>::vf &v) {
+    typedef Lanes<N> L;
+    typedef typename L::vi vi;
+    typedef typename L::vu vu;
+    typedef typename L::vf vf;
+
+    vi iu, iv;
+    FloorLanes<N>(iu, u);
+    FloorLanes<N>(iv, v);
+    vf fu = (u - __builtin_convertvector(iu, vf)) * (float) mip.width;
+    vf fv = (v - __builtin_convertvector(iv, vf)) * (float) mip.height;
+
+    if (filter == FILTER_NEAREST) {
+        L::Clamp(fu, 0.0f, (float) (mip.width - 1));
+        L::Clamp(fv, 0.0f, (float) (mip.height - 1));
+
+        GatherTexels<N>(r, mip, __builtin_convertvector(fu, vi), __builtin_convertvector(fv, vi));
+        return;
+    }
+
+    // Texel centers are at half coordinates
+    fu -= 0.5f;
+    fv -= 0.5f;
+
+    vi x0, y0;
+    FloorLanes<N>(x0, fu);
+    FloorLanes<N>(y0, fv);
+    vu wx = __builtin_convertvector(__builtin_convertvector((fu - __builtin_convertvector(x0, vf)) * 256.0f, vi), vu);
+    vu wy = __builtin_convertvector(__builtin_convertvector((fv - __builtin_convertvector(y0, vf)) * 256.0f, vi), vu);
+
+    x0 += mip.width & (x0 < 0);
+    y0 += mip.height & (y0 < 0);
+    vi x1 = x0 + 1, y1 = y0 + 1;
+    x1 &= x1 < mip.width;
+    y1 &= y1 < mip.height;
+
+    vu t00, t10, t01, t11, top, bottom;
+    GatherTexels<N>(t00, mip, x0, y0);
+    GatherTexels<N>(t10, mip, x1, y0);
+    GatherTexels<N>(t01, mip, x0, y1);
+    GatherTexels<N>(t11, mip, x1, y1);
+
+    LerpTexelLanes<N>(top, t00, t10, wx);
+    LerpTexelLanes<N>(bottom, t01, t11, wx);
+    LerpTexelLanes<N>(r, top, bottom, wy);
+}
+
+template <int N>
+SIMD_INLINE void TextureLanes(typename Lanes<N>::vi &col, const EdgeSetup &s, const EdgeBlockUV &uv, int bx, int by,
+                              const typename Lanes<N>::vf &fx, const typename Lanes<N>::vf &fy) {
+    typedef Lanes<N> L;
+    typedef typename L::vu vu;
+    typedef typename L::vf vf;
+
+    vf u, v;
+    if (s.subdivide) {
+        // Bilinear between the block corners
+        vf gx = (fx - (float) bx) * (1.0f / EDGE_BLOCK);
+        vf gy = (fy - (float) by) * (1.0f / EDGE_BLOCK);
+
+        vf uTop = uv.u[0] + (uv.u[1] - uv.u[0]) * gx, uBottom = uv.u[2] + (uv.u[3] - uv.u[2]) * gx;
+        vf vTop = uv.v[0] + (uv.v[1] - uv.v[0]) * gx, vBottom = uv.v[2] + (uv.v[3] - uv.v[2]) * gx;
+        u = uTop + (uBottom - uTop) * gy;
+        v = vTop + (vBottom - vTop) * gy;
+    } else {
+        vf w, uw, vw;
+        PlaneLanes<N>(w, s.w, fx, fy);
+        PlaneLanes<N>(uw, s.u, fx, fy);
+        PlaneLanes<N>(vw, s.v, fx, fy);
+
+        L::Clamp(w, s.wMin, s.wMax);
+        vf q = 1.0f / w;
+        u = uw * q;
+        v = vw * q;
+    }
+
+    vu texel;
+    SampleLanes<N>(texel, *s.mip, s.filter, u, v);
+
+    // Lit by the triangle's color
+    vu r = (((texel >> 16) & 0xff) * (((s.col >> 16) & 0xff) + 1)) >> 8;
+    vu g = (((texel >> 8) & 0xff) * (((s.col >> 8) & 0xff) + 1)) >> 8;
+    vu b = ((texel & 0xff) * ((s.col & 0xff) + 1)) >> 8;
+
+    col = (typename L::vi) ((r << 16) | (g << 8) | b);
+}
+
+// Color of N pixels laid out in rows of EDGE_BLOCK, starting at (x, y)
+template <int N, ShadeMode SHADE>
+SIMD_INLINE void ColorLanes(typename Lanes<N>::vi &col, const EdgeSetup &s, const EdgeBlockUV &uv, int x, int y,
+                            const typename Lanes<N>::vf &fx, const typename Lanes<N>::vf &fy) {
+    typedef typename Lanes<N>::vi vi;
+
+    if (SHADE == SHADE_SMOOTH) {
+        vi r, g, b;
+        ChannelLanes<N>(r, s.red, fx, fy);
+        ChannelLanes<N>(g, s.green, fx, fy);
+        ChannelLanes<N>(b, s.blue, fx, fy);
+        col = (r << 16) | (g << 8) | b;
+    } else if (SHADE == SHADE_TEXTURED) {
+        TextureLanes<N>(col, s, uv, x & ~(EDGE_BLOCK - 1), y & ~(EDGE_BLOCK - 1), fx, fy);
+    } else {
+        Lanes<N>::Splat(col, s.col);
+    }
+}
+
+// Shades N pixels laid out in rows of EDGE_BLOCK, starting at (x, y). When
+// `full` is set every pixel is covered and there's nothing to blend with.
+template <int N, DepthMode DEPTH, ShadeMode SHADE>
+SIMD_INLINE void ShadeEdgeLanes(const EdgeSetup &s, const RasterBuffers &buf, int x, int y,
+                                const typename Lanes<N>::vi &coverage, bool full, const EdgeBlockUV &uv) {
+    typedef Lanes<N> L;
+    typedef typename L::vi vi;
+    typedef typename L::vf vf;
+    typedef typename L::vh vh;
+
+    const int W = N < EDGE_BLOCK ? N : EDGE_BLOCK;
+
+    vi ramp;
+    L::Ramp(ramp);
+    vf fx = __builtin_convertvector(x + ramp % EDGE_BLOCK, vf);
+    vf fy = __builtin_convertvector(y + ramp / EDGE_BLOCK, vf);
+    int offset = y * buf.width + x;
+    vi mask = coverage;
+
+    if (buf.overdraw) {
+        vh count16;
+        L::Load(count16, buf.overdraw + offset, W, buf.width);
+        vi count = __builtin_convertvector(count16, vi) - mask;
+        L::Store(buf.overdraw + offset, W, buf.width, __builtin_convertvector(count, vh));
+    }
+
+    if (DEPTH != DEPTH_NONE) {
+        vf z;
+        PlaneLanes<N>(z, s.depth, fx, fy);
+
+        if (DEPTH == DEPTH_32F) {
+            float* zp = (float*) buf.depth + offset;
+            vf old;
+            L::Load(old, zp, W, buf.width);
+
+            mask &= z < old;
+            if (!L::Any(mask))
+                return;
+
+            vf out;
+            L::Select(out, mask, z, old);
+            L::Store(zp, W, buf.width, out);
+        } else {
+            uint16_t* zp = (uint16_t*) buf.depth + offset;
+            vh old16;
+            L::Load(old16, zp, W, buf.width);
+            vi old = __builtin_convertvector(old16, vi);
+
+            // Same rounding as StoreDepth<uint16_t>
+            L::Clamp(z, 0.0f, 65535.0f);
+            vi q = __builtin_convertvector(z + 0.5f, vi);
+
+            mask &= q < old;
+            if (!L::Any(mask))
+                return;
+
+            vi out = (q & mask) | (old & ~mask);
+            L::Store(zp, W, buf.width, __builtin_convertvector(out, vh));
+        }
+
+        full = false;
+    }
+
+    vi col = {};
+    ColorLanes<N, SHADE>(col, s, uv, x, y, fx, fy);
+
+    int32_t* pp = (int32_t*) buf.pixels + offset;
+    if (!full) {
+        vi old;
+        L::Load(old, pp, W, buf.width);
+        col = (col & mask) | (old & ~mask);
+    }
+
+    L::Store(pp, W, buf.width, col);
+}
+
+template <int N, DepthMode DEPTH, ShadeMode SHADE>
+SIMD_INLINE void RasterizeEdgeBlocks(const EdgeSetup &s, const RasterBuffers &buf) {
+    typedef Lanes<N> L;
+    typedef typename L::vi vi;
+
+    const int B = EDGE_BLOCK;
+    const typename Lanes<1>::vi one = { -1, -1 };
+    const vi all = vi {} == vi {};
+
+    vi ramp;
+    L::Ramp(ramp);
+    vi offset[3];
+    for (int i = 0; i < 3; i++)
+        offset[i] = s.A[i] * (ramp % B) + s.B[i] * (ramp / B);
+
+    // Blocks are aligned on the screen so a pixel always falls in the same
+    // block and gets the same result whatever the bounding box or scissor
+    int bx0 = s.minX & ~(B - 1);
+    int by0 = s.minY & ~(B - 1);
+
+    for (int by = by0; by <= s.maxY; by += B) {
+        for (int bx = bx0; bx <= s.maxX; bx += B) {
+            int e[3];
+            bool accept = true;
+            bool reject = false;
+
+            // Trivial accept or reject from the block corners
+            for (int i = 0; i < 3; i++) {
+                e[i] = s.A[i] * (bx - s.ox) + s.B[i] * (by - s.oy) + s.C[i];
+
+                int eMax = e[i] + (std::max(s.A[i], 0) + std::max(s.B[i], 0)) * (B - 1);
+                int eMin = e[i] + (std::min(s.A[i], 0) + std::min(s.B[i], 0)) * (B - 1);
+
+                if (eMax < 0) reject = true;
+                if (eMin < 0) accept = false;
+            }
+
+            if (reject)
+                continue;
+
+            EdgeBlockUV uv = {};
+            if (SHADE == SHADE_TEXTURED && s.subdivide)
+                BlockUV(s, bx, by, uv);
+
+            // Blocks crossing the scissor are done one pixel at a time
+            if (bx < buf.clipX0 || by < buf.clipY0 || bx + B - 1 > buf.clipX1 || by + B - 1 > buf.clipY1) {
+                int x0 = std::max(bx, buf.clipX0), x1 = std::min(bx + B - 1, buf.clipX1);
+                int y0 = std::max(by, buf.clipY0), y1 = std::min(by + B - 1, buf.clipY1);
+
+                for (int y = y0; y <= y1; y++) {
+                    for (int x = x0; x <= x1; x++) {
+                        int dx = x - bx, dy = y - by;
+                        int w0 = e[0] + s.A[0] * dx + s.B[0] * dy;
+                        int w1 = e[1] + s.A[1] * dx + s.B[1] * dy;
+                        int w2 = e[2] + s.A[2] * dx + s.B[2] * dy;
+
+                        if ((w0 | w1 | w2) >= 0)
+                            ShadeEdgeLanes<1, DEPTH, SHADE>(s, buf, x, y, one, false, uv);
+                    }
+                }
+                continue;
+            }
+
+            for (int k = 0; k < B * B; k += N) {
+                int gx = k % B, gy = k / B;
+                vi mask = all;
+
+                if (!accept) {
+                    vi w0 = (e[0] + s.A[0] * gx + s.B[0] * gy) + offset[0];
+                    vi w1 = (e[1] + s.A[1] * gx + s.B[1] * gy) + offset[1];
+                    vi w2 = (e[2] + s.A[2] * gx + s.B[2] * gy) + offset[2];
+
+                    mask = (w0 | w1 | w2) >= 0;
+                    if (!L::Any(mask))
+                        continue;
+                }
+
+                ShadeEdgeLanes<N, DEPTH, SHADE>(s, buf, bx + gx, by + gy, mask, accept, uv);
+            }
+        }
+    }
+}
+
+// Triangle ID of the pixels no triangle covers in the visibility buffer
+const uint32_t VISIBLE_NONE = 0xffffffff;
+
+// Shading pass of the visibility buffer, the pixels of the N lanes at
+// (x, y) whose triangle ID is `id` get the color of triangle s. Same
+// colors as the edge rasterizer drawing the triangle.
+template <int N, ShadeMode SHADE>
+SIMD_INLINE void ShadeVisibleLanes(const EdgeSetup &s, const RasterBuffers &buf, const uint32_t* ids, uint32_t id,
+                                   int x, int y) {
+    typedef Lanes<N> L;
+    typedef typename L::vi vi;
+    typedef typename L::vf vf;
+
+    const int W = N < EDGE_BLOCK ? N : EDGE_BLOCK;
+
+    vi ramp;
+    L::Ramp(ramp);
+    vf fx = __builtin_convertvector(x + ramp % EDGE_BLOCK, vf);
+    vf fy = __builtin_convertvector(y + ramp / EDGE_BLOCK, vf);
+    int offset = y * buf.width + x;
+
+    vi visible;
+    L::Load(visible, ids + offset, W, buf.width);
+    vi mask = visible == (int32_t) id;
+
+    EdgeBlockUV uv = {};
+    if (SHADE == SHADE_TEXTURED && s.subdivide)
+        BlockUV(s, x & ~(EDGE_BLOCK - 1), y & ~(EDGE_BLOCK - 1), uv);
+
+    vi col = {}, old;
+    ColorLanes<N, SHADE>(col, s, uv, x, y, fx, fy);
+
+    int32_t* pp = (int32_t*) buf.pixels + offset;
+    L::Load(old, pp, W, buf.width);
+    L::Store(pp, W, buf.width, (col & mask) | (old & ~mask));
+}
+
+// One wrapper per instruction set, the kernels are inlined into them
+template <DepthMode DEPTH, ShadeMode SHADE>
+SIMD_EXACT void RasterizeEdgesScalar(const EdgeSetup &s, const RasterBuffers &buf) {
+    RasterizeEdgeBlocks<1, DEPTH, SHADE>(s, buf);
+}
+
+template <DepthMode DEPTH, ShadeMode SHADE>
+SIMD_TARGET("sse2") void RasterizeEdgesSSE2(const EdgeSetup &s, const RasterBuffers &buf) {
+    RasterizeEdgeBlocks<4, DEPTH, SHADE>(s, buf);
+}
+
+#ifdef SIMD_X86
+template <DepthMode DEPTH, ShadeMode SHADE>
+SIMD_TARGET("avx2") void RasterizeEdgesAVX2(const EdgeSetup &s, const RasterBuffers &buf) {
+    RasterizeEdgeBlocks<8, DEPTH, SHADE>(s, buf);
+}
+
+template <DepthMode DEPTH, ShadeMode SHADE>
+SIMD_TARGET("avx512f") void RasterizeEdgesAVX512(const EdgeSetup &s, const RasterBuffers &buf) {
+    RasterizeEdgeBlocks<16, DEPTH, SHADE>(s, buf);
+}
+#endif
+
+template <DepthMode DEPTH, ShadeMode SHADE>
+void RasterizeEdges(SimdLevel level, const EdgeSetup &s, const RasterBuffers &buf) {
+    switch (level) {
+#ifdef SIMD_X86
+        case SIMD_AVX512: RasterizeEdgesAVX512<DEPTH, SHADE>(s, buf); break;
+        case SIMD_AVX2:   RasterizeEdgesAVX2<DEPTH, SHADE>(s, buf); break;
+#else
+        case SIMD_AVX512:
+        case SIMD_AVX2:
+#endif
+        case SIMD_SSE2:   RasterizeEdgesSSE2<DEPTH, SHADE>(s, buf); break;
+        case SIMD_SCALAR: RasterizeEdgesScalar<DEPTH, SHADE>(s, buf); break;
+    }
+}
+
+template <DepthMode DEPTH>
+void RasterizeEdges(SimdLevel level, ShadeMode shade, const EdgeSetup &s, const RasterBuffers &buf) {
+    switch (shade) {
+        case SHADE_FLAT:     RasterizeEdges<DEPTH, SHADE_FLAT>(level, s, buf); break;
+        case SHADE_SMOOTH:   RasterizeEdges<DEPTH, SHADE_SMOOTH>(level, s, buf); break;
+        case SHADE_TEXTURED: RasterizeEdges<DEPTH, SHADE_TEXTURED>(level, s, buf); break;
+    }
+}
+
+inline void RasterizeEdges(SimdLevel level, DepthMode depth, ShadeMode shade, const EdgeSetup &s, const RasterBuffers &buf) {
+    switch (depth) {
+        case DEPTH_NONE: RasterizeEdges<DEPTH_NONE>(level, shade, s, buf); break;
+        case DEPTH_16:   RasterizeEdges<DEPTH_16>(level, shade, s, buf); break;
+        case DEPTH_32F:  RasterizeEdges<DEPTH_32F>(level, shade, s, buf); break;
+    }
+}
+
+// Visibility buffer shading, same dispatch as RasterizeEdges()
+template <ShadeMode SHADE>
+SIMD_EXACT void ShadeVisibleScalar(const EdgeSetup &s, const RasterBuffers &buf, const uint32_t* ids, uint32_t id, int x, int y) {
+    ShadeVisibleLanes<1, SHADE>(s, buf, ids, id, x, y);
+}
+
+template <ShadeMode SHADE>
+SIMD_TARGET("sse2") void ShadeVisibleSSE2(const EdgeSetup &s, const RasterBuffers &buf, const uint32_t* ids, uint32_t id, int x, int y) {
+    ShadeVisibleLanes<4, SHADE>(s, buf, ids, id, x, y);
+}
+
+#ifdef SIMD_X86
+template <ShadeMode SHADE>
+SIMD_TARGET("avx2") void ShadeVisibleAVX2(const EdgeSetup &s, const RasterBuffers &buf, const uint32_t* ids, uint32_t id, int x, int y) {
+    ShadeVisibleLanes<8, SHADE>(s, buf, ids, id, x, y);
+}
+
+template <ShadeMode SHADE>
+SIMD_TARGET("avx512f") void ShadeVisibleAVX512(const EdgeSetup &s, const RasterBuffers &buf, const uint32_t* ids, uint32_t id, int x, int y) {
+    ShadeVisibleLanes<16, SHADE>(s, buf, ids, id, x, y);
+}
+#endif
+
+template <ShadeMode SHADE>
+void ShadeVisible(SimdLevel level, const EdgeSetup &s, const RasterBuffers &buf, const uint32_t* ids, uint32_t id, int x, int y) {
+    switch (level) {
+#ifdef SIMD_X86
+        case SIMD_AVX512: ShadeVisibleAVX512<SHADE>(s, buf, ids, id, x, y); break;
+        case SIMD_AVX2:   ShadeVisibleAVX2<SHADE>(s, buf, ids, id, x, y); break;
+#else
+        case SIMD_AVX512:
+        case SIMD_AVX2:
+#endif
+        case SIMD_SSE2:   ShadeVisibleSSE2<SHADE>(s, buf, ids, id, x, y); break;
+        case SIMD_SCALAR: ShadeVisibleScalar<SHADE>(s, buf, ids, id, x, y); break;
+    }
+}
+
+inline void ShadeVisible(SimdLevel level, ShadeMode shade, const EdgeSetup &s, const RasterBuffers &buf,
+                         const uint32_t* ids, uint32_t id, int x, int y) {
+    switch (shade) {
+        case SHADE_FLAT:     ShadeVisible<SHADE_FLAT>(level, s, buf, ids, id, x, y); break;
+        case SHADE_SMOOTH:   ShadeVisible<SHADE_SMOOTH>(level, s, buf, ids, id, x, y); break;
+        case SHADE_TEXTURED: ShadeVisible<SHADE_TEXTURED>(level, s, buf, ids, id, x, y); break;
+    }
+}
+
+#endif
@@ -2,24 +2,278 @@
 #define _RENDERER
 
 #include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <memory>
 #include <SDL2/SDL.h>
 
 #include "Vec3d.cpp"
 #include "Triangle.cpp"
+#include "Clipper.cpp"
+#include "Rasterizer.cpp"
+#include "ThreadPool.cpp"
+#include "HiZ.cpp"
+#include "SpanBuffer.cpp"
+#include "Presenter.cpp"
+#include "Mat4x4.cpp"
+#include "Reprojection.cpp"
+
+// Where the raster routines write their pixels
+enum RenderTarget {
+    TARGET_FRAMEBUFFER,     // CPU side framebuffer, uploaded once per frame
+    TARGET_SDL,             // Direct SDL_Renderer draw calls
+};
+
+// Triangle rasterization algorithm, only the framebuffer target has a choice
+enum RasterMode {
+    RASTER_SCANLINE,        // Bresenham edge walkers filling horizontal spans
+    RASTER_EDGE,            // SIMD edge functions over 8x8 blocks
+    RASTER_SPANS,           // Scanline spans clipped by a span buffer, front to back, flat shaded
+    RASTER_VISIBILITY,      // Edge functions writing depth and triangle IDs, each pixel shaded once afterwards
+};
+
+// Width in pixels of the runs used for early depth rejection
+const int DEPTH_SEGMENT = 32;
+
+// Size of the screen tiles triangles are binned into when rasterizing with
+// several threads, a multiple of DEPTH_SEGMENT and EDGE_BLOCK so that no
+// depth run or edge block straddles two tiles
+const int TILE_SIZE = 64;
+
+// Most fractional bits of the edge rasterizer's fixed point vertices
+const int SUBPIXEL_BITS_MAX = 8;
+
+// Pixels past each edge of the screen a triangle may reach and still go to
+// the rasterizers as it is, their scissor keeps it on screen. Triangles
+// reaching further are clipped to the band. Wider, the edge functions of a
+// 1024 pixels wide screen would fall back to fewer than 4 sub-pixel bits.
+const float GUARD_BAND = 256;
+
+// Clips a segment to the rectangle, Liang-Barsky. Returns false when none
+// of it is inside.
+inline bool ClipLine(float &x1, float &y1, float &x2, float &y2, float minX, float minY, float maxX, float maxY) {
+    float dx = x2 - x1, dy = y2 - y1;
+    float p[4] = { -dx, dx, -dy, dy };
+    float q[4] = { x1 - minX, maxX - x1, y1 - minY, maxY - y1 };
+    float t0 = 0, t1 = 1;
+
+    // Also catches NaN coordinates, every comparison with them fails
+    if (!(q[0] == q[0] && q[2] == q[2] && dx == dx && dy == dy))
+        return false;
+
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0) {
+            // Parallel to the edge, inside or outside of it all along
+            if (q[i] < 0)
+                return false;
+            continue;
+        }
+
+        float t = q[i] / p[i];
+        if (p[i] < 0) {
+            if (t > t1) return false;
+            t0 = std::max(t0, t);
+        } else {
+            if (t < t0) return false;
+            t1 = std::min(t1, t);
+        }
+    }
+
+    // Rounding may leave the ends a bit outside
+    float sx = x1, sy = y1;
+    x1 = std::min(maxX, std::max(minX, sx + t0 * dx));
+    y1 = std::min(maxY, std::max(minY, sy + t0 * dy));
+    x2 = std::min(maxX, std::max(minX, sx + t1 * dx));
+    y2 = std::min(maxY, std::max(minY, sy + t1 * dy));
+
+    return true;
+}
+
+// Triangle drawn into the visibility buffer, with how it's shaded once
+// the visible pixels are known
+struct VisibleTriangle {
+    Triangle tri;
+    ShadeMode shade;
+    const Texture* texture;
+};
 
 struct Renderer {
     SDL_Renderer* renderer;
+    SDL_Texture* texture;
     int width;
     int height;
 
+    // Size of the window, the texture and the most the framebuffer can be.
+    // A smaller framebuffer is scaled up to it when presented.
+    int outputWidth;
+    int outputHeight;
+
+    RenderTarget target;
+    RasterMode rasterMode;
+    ShadeMode shadeMode;
+    SimdLevel simdLevel;
+
+    // Fractional bits of the edge rasterizer's vertices, pixels are then
+    // sampled at their centers with a top-left fill rule so triangles
+    // sharing an edge never both draw a pixel. 0 truncates the vertices
+    // and includes every edge, like the scanline rasterizer.
+    int subPixelBits;
+
+    // 0x00RRGGBB pixels, row 0 is the top of the screen
+    std::vector<uint32_t> pixels;
+    uint32_t drawColor;
+
+    // Spans and points of TARGET_SDL waiting to be drawn in drawColor, with
+    // one SDL_RenderFillRects() and one SDL_RenderDrawPoints() call when the
+    // color changes or the frame ends
+    bool drawColorSet;
+    std::vector<SDL_Rect> rects;
+    std::vector<SDL_Point> points;
+    int drawCalls;
+
+    // Bits kept of each channel of the colors drawn on TARGET_SDL, fewer
+    // bits make neighbouring triangles share a color and a batch
+    int colorBits;
+
+    // Depth is stored so that smaller is always nearer, reverse-Z only
+    // changes how the incoming projected z is encoded
+    DepthMode depthMode;
+    bool reverseZ;
+    std::vector<uint16_t> depth16;
+    std::vector<float> depth32;
+
+    // Farthest stored depth of each DEPTH_SEGMENT pixels run of a row
+    std::vector<float> depthFar;
+    int depthSegments;
+
+    // Built on demand from the depth buffer for occlusion culling
+    HiZBuffer hiZ;
+
+    // Spans already drawn by RASTER_SPANS since the last Fill(), one list
+    // per row of each screen tile column so threads never share one
+    SpanBuffer spans;
+
+    // RASTER_VISIBILITY's first pass writes the index in visible of the
+    // triangle nearest each pixel, the second one shades the pixels of
+    // triangles from visibleShaded on. Shading costs once per pixel,
+    // whatever the overdraw.
+    std::vector<uint32_t> visibility;
+    std::vector<VisibleTriangle> visible;
+    uint32_t visibleShaded;
+
+    // Checkerboard rendering of RASTER_VISIBILITY with a depth buffer, each
+    // frame shades every other cell of a checkerboard flipping between
+    // frames. The other pixels are reprojected from the previous frame with
+    // viewProj, those it didn't show are shaded as well. Cells are the lane
+    // groups of the shading pass, so its SIMD kernels skip whole groups.
+    bool checkerboard;
+    uint32_t frameIndex;
+    Mat4x4 viewProj;
+    bool viewProjSet;
+    FrameHistory history;
+    FrameHistory previous;
+    Reprojection reprojection;
+    bool reprojecting;
+
+    // Triangles covering each pixel since the last Fill(), when counting
+    bool countOverdraw;
+    std::vector<uint16_t> overdraw;
+
+    // Sampled by SHADE_TEXTURED, the affine subdivision trades exactness
+    // for one perspective division per EDGE_BLOCK pixels instead of one per pixel
+    const Texture* boundTexture;
+    TextureFilter textureFilter;
+    bool textureSubdivide;
+
+    // Shows the frames from its own thread when started, Present() then
+    // only hands the framebuffer over
+    std::unique_ptr<Presenter> presenter;
+
+    // Multithreaded rasterization, triangles are queued and binned into
+    // tiles that the pool rasterizes independently
+    std::unique_ptr<ThreadPool> pool;
+    std::vector<Triangle> queued;
+    std::vector<std::vector<uint32_t>> bins;
+    int tilesX, tilesY;
+
     Renderer() {
         renderer = NULL;
+        texture = NULL;
+        width = height = 0;
+        outputWidth = outputHeight = 0;
+        target = TARGET_SDL;
+        rasterMode = RASTER_SCANLINE;
+        shadeMode = SHADE_FLAT;
+        simdLevel = SIMD_SCALAR;
+        drawColor = 0;
+        drawColorSet = false;
+        drawCalls = 0;
+        colorBits = 8;
+        depthMode = DEPTH_NONE;
+        reverseZ = false;
+        depthSegments = 0;
+        tilesX = tilesY = 0;
+        boundTexture = NULL;
+        textureFilter = FILTER_BILINEAR;
+        textureSubdivide = false;
+        subPixelBits = 0;
+        countOverdraw = false;
+        visibleShaded = 0;
+        checkerboard = false;
+        frameIndex = 0;
+        viewProjSet = false;
+        reprojecting = false;
     }
 
     Renderer (SDL_Renderer* r, int w, int h) {
         renderer = r;
-        width = w;
-        height = h;
+        width = outputWidth = w;
+        height = outputHeight = h;
+        rasterMode = RASTER_SCANLINE;
+        shadeMode = SHADE_FLAT;
+        simdLevel = DetectSimdLevel();
+        drawColor = 0;
+        drawColorSet = false;
+        drawCalls = 0;
+        colorBits = 8;
+        depthMode = DEPTH_NONE;
+        reverseZ = false;
+        depthSegments = 0;
+        tilesX = tilesY = 0;
+        boundTexture = NULL;
+        textureFilter = FILTER_BILINEAR;
+        textureSubdivide = false;
+        subPixelBits = 0;
+        countOverdraw = false;
+        visibleShaded = 0;
+        checkerboard = false;
+        frameIndex = 0;
+        viewProjSet = false;
+        reprojecting = false;
+
+        spans.Resize(h);
+
+        // Without an SDL renderer the frames are shown by StartPresenter()'s thread
+        texture = r ? SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, w, h) : NULL;
+
+        if (texture || !r) {
+            target = TARGET_FRAMEBUFFER;
+            pixels.assign(w * h, 0);
+        } else {
+            fprintf(stderr,"Erreur de création de la texture: %s\n",SDL_GetError());
+            target = TARGET_SDL;
+        }
+    }
+
+    void Destroy() {
+        presenter.reset();
+        pool.reset();
+
+        if (texture) {
+            SDL_DestroyTexture(texture);
+            texture = NULL;
+        }
     }
 
     void HexToRGB(uint32_t &hex, uint8_t &r, uint8_t &g, uint8_t &b) {
@@ -28,20 +282,545 @@ struct Renderer {
         b = hex & 0x0000ff;
     }
 
+    void SetDrawColor(uint32_t col) {
+        if (col == drawColor && drawColorSet)
+            return;
+
+        FlushBatches();
+        drawColor = col;
+
+        if (target == TARGET_SDL) {
+            uint8_t r, g, b;
+            HexToRGB(col, r, g, b);
+            SDL_SetRenderDrawColor(renderer, r, g, b, SDL_ALPHA_OPAQUE);
+            drawColorSet = true;
+        }
+    }
+
+    // Draws what's been batched in drawColor. Everything in a batch has the
+    // same color, so drawing it out of order changes nothing.
+    void FlushBatches() {
+        if (!rects.empty()) {
+            SDL_RenderFillRects(renderer, rects.data(), rects.size());
+            rects.clear();
+            drawCalls++;
+        }
+
+        if (!points.empty()) {
+            SDL_RenderDrawPoints(renderer, points.data(), points.size());
+            points.clear();
+            drawCalls++;
+        }
+    }
+
+    // Rounds each channel to the nearest of 2^colorBits levels
+    uint32_t QuantizeColor(uint32_t col) const {
+        if (colorBits >= 8)
+            return col;
+
+        int levels = (1 << std::max(1, colorBits)) - 1;
+        uint32_t r = 0;
+        for (int shift = 0; shift < 24; shift += 8) {
+            int level = (((col >> shift) & 0xff) * levels + 127) / 255;
+            r |= (uint32_t) (level * 255 / levels) << shift;
+        }
+
+        return r;
+    }
+
+    // Shows the frames from a thread of their own, which creates its SDL
+    // renderer for the window. Up to framesInFlight frames wait to be shown
+    // while the next one is drawn, more trade latency for smoother
+    // throughput. Needs the renderer built without an SDL renderer.
+    bool StartPresenter(SDL_Window* window, int framesInFlight) {
+        if (renderer || target != TARGET_FRAMEBUFFER)
+            return false;
+
+        presenter.reset(new Presenter());
+        if (!presenter->Start(window, outputWidth, outputHeight, framesInFlight)) {
+            presenter.reset();
+            return false;
+        }
+
+        return true;
+    }
+
+    // Threads used to rasterize triangles, 1 draws them as they're submitted
+    void SetThreadCount(int threads) {
+        Flush();
+
+        if (threads < 1)
+            threads = std::max(1, (int) std::thread::hardware_concurrency());
+
+        if (target != TARGET_FRAMEBUFFER || threads == 1)
+            pool.reset();
+        else
+            pool.reset(new ThreadPool(threads));
+
+        ResizeTiles();
+    }
+
+    // Screen tiles of the thread pool and the rows of the span buffer
+    void ResizeTiles() {
+        if (!pool) {
+            bins.clear();
+            spans.Resize(height);
+            return;
+        }
+
+        tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+        bins.assign(tilesX * tilesY, std::vector<uint32_t>());
+        spans.Resize(height * tilesX);
+    }
+
+    // Size of the framebuffer, up to the output size. Everything sized on
+    // it is reallocated and cleared, so it's meant for between two frames.
+    // Only the framebuffer target can change it.
+    bool SetResolution(int w, int h) {
+        if (target != TARGET_FRAMEBUFFER)
+            return false;
+
+        w = std::min(std::max(w, 1), outputWidth);
+        h = std::min(std::max(h, 1), outputHeight);
+        if (w == width && h == height)
+            return true;
+
+        Flush();
+
+        width = w;
+        height = h;
+        pixels.assign(width * height, 0);
+
+        visibility.clear();
+        visible.clear();
+        visibleShaded = 0;
+
+        ResizeTiles();
+        SetDepthMode(depthMode, reverseZ);
+        SetOverdrawCounting(countOverdraw);
+
+        return true;
+    }
+
+    int ThreadCount() const {
+        return pool ? pool->Size() : 1;
+    }
+
+    // Rasterizes the queued triangles, each tile gets its triangles in
+    // submission order so the result is the same as drawing them one by one
+    void Flush() {
+        if (queued.empty())
+            return;
+
+        pool->Run(tilesX * tilesY, [this](int tile) {
+            std::vector<uint32_t> &bin = bins[tile];
+            if (bin.empty())
+                return;
+
+            RasterBuffers buf = TileBuffers(tile);
+
+            for (uint32_t i : bin)
+                RasterizeTriangle(queued[i], buf);
+
+            bin.clear();
+        });
+
+        queued.clear();
+    }
+
     void Fill(uint32_t col) {
-        uint8_t r, g, b;
-        HexToRGB(col, r, g, b);
+        Flush();
+
+        // The frame drawn last is the one reprojected from
+        std::swap(history, previous);
+        history.valid = false;
+        viewProjSet = false;
+        frameIndex++;
+
+        std::fill(overdraw.begin(), overdraw.end(), 0);
+        spans.Clear();
 
-        SDL_SetRenderDrawColor(renderer, r, g, b, SDL_ALPHA_OPAQUE);
+        visible.clear();
+        visibleShaded = 0;
+        if (rasterMode == RASTER_VISIBILITY && target == TARGET_FRAMEBUFFER)
+            visibility.assign(width * height, VISIBLE_NONE);
+        else
+            visibility.clear();
+
+        if (target == TARGET_FRAMEBUFFER) {
+            std::fill(pixels.begin(), pixels.end(), col);
+            return;
+        }
+
+        SetDrawColor(col);
+        FlushBatches();
         SDL_RenderClear(renderer);
+        drawCalls = 0;
     }
 
-    void DrawLine(Vec3d p1, Vec3d p2) {
+    // World to the screen space of the triangles drawn in this frame, y up
+    // and before the division by w. Checkerboard rendering needs it after
+    // each Fill(), to follow the camera from one frame to the next.
+    void SetViewProjection(const Mat4x4 &m) {
+        viewProj = m;
+        viewProjSet = true;
+    }
+
+    void SetOverdrawCounting(bool count) {
+        Flush();
+
+        countOverdraw = count && target == TARGET_FRAMEBUFFER;
+        overdraw.assign(countOverdraw ? width * height : 0, 0);
+    }
+
+    // Pixels covered by triangles, counting each triangle, and pixels
+    // covered at least once. Their ratio is the average overdraw.
+    void OverdrawStats(uint64_t &covered, uint64_t &touched) {
+        Flush();
+
+        covered = touched = 0;
+        for (uint16_t n : overdraw) {
+            covered += n;
+            touched += n != 0;
+        }
+    }
+
+    // Texture used by the following triangles, NULL draws them flat
+    void SetTexture(const Texture* tex) {
+        Flush();
+        boundTexture = tex;
+    }
+
+    // Textured triangles without a texture are drawn flat
+    ShadeMode EffectiveShadeMode() const {
+        if (shadeMode == SHADE_TEXTURED && (!boundTexture || boundTexture->mips.empty()))
+            return SHADE_FLAT;
+
+        return shadeMode;
+    }
+
+    // Depth testing needs the framebuffer target, it's ignored otherwise
+    void SetDepthMode(DepthMode mode, bool reverse = false) {
+        Flush();
+
+        depthMode = target == TARGET_FRAMEBUFFER ? mode : DEPTH_NONE;
+        reverseZ = reverse;
+
+        depth16.clear();
+        depth32.clear();
+        depthFar.clear();
+        depthSegments = 0;
+
+        if (depthMode == DEPTH_16)
+            depth16.resize(width * height);
+        if (depthMode == DEPTH_32F)
+            depth32.resize(width * height);
+
+        if (depthMode != DEPTH_NONE) {
+            depthSegments = (width + DEPTH_SEGMENT - 1) / DEPTH_SEGMENT;
+            depthFar.resize(depthSegments * height);
+            hiZ.Resize(width, height);
+        }
+
+        ClearDepth();
+    }
+
+    float DepthClearValue() const {
+        if (depthMode == DEPTH_16)
+            return 65535;
+
+        return reverseZ ? 0.0f : 1.0f;
+    }
+
+    void ClearDepth() {
+        Flush();
+
+        float clear = DepthClearValue();
+
+        if (depthMode == DEPTH_16)
+            std::fill(depth16.begin(), depth16.end(), (uint16_t) clear);
+        if (depthMode == DEPTH_32F)
+            std::fill(depth32.begin(), depth32.end(), clear);
+
+        std::fill(depthFar.begin(), depthFar.end(), clear);
+        hiZ.valid = false;
+    }
+
+    // Snapshot of what's been drawn so far, used by IsOccluded()
+    void BuildHiZ() {
+        Flush();
+
+        if (depthMode == DEPTH_16)
+            hiZ.Build(depth16.data(), width, height, pool.get());
+        if (depthMode == DEPTH_32F)
+            hiZ.Build(depth32.data(), width, height, pool.get());
+    }
+
+    // True when something bounded by the screen space rectangle, with
+    // projected depths between zMin and zMax, would fail the depth test
+    // against the last BuildHiZ() everywhere
+    bool IsOccluded(float minX, float minY, float maxX, float maxY, float zMin, float zMax) const {
+        if (depthMode == DEPTH_NONE)
+            return false;
+
+        // One pixel margin for the rasterizers' snapping
+        int x0 = std::max(0, (int) minX - 1);
+        int x1 = std::min(width - 1, (int) maxX + 1);
+        int y0 = std::max(0, (int) (height - maxY) - 1);
+        int y1 = std::min(height - 1, (int) (height - minY) + 1);
+
+        if (x0 > x1 || y0 > y1)
+            return false;
+
+        float nearest = std::min(EncodeDepth(zMin), EncodeDepth(zMax));
+        if (depthMode == DEPTH_16)
+            nearest = StoreDepth<uint16_t>(nearest);
+
+        return hiZ.IsOccluded(x0, y0, x1, y1, nearest);
+    }
+
+    // Projected z of a value in the depth buffer, z = depth * scale + offset
+    void DepthDecoding(float &scale, float &offset) const {
+        scale = reverseZ ? -1.0f : 1.0f;
+        offset = 0;
+
+        if (depthMode == DEPTH_16) {
+            scale /= 65535.0f;
+            offset = reverseZ ? 1.0f : 0.0f;
+        }
+    }
+
+    // Projected z in [0, 1] to the value compared in the depth buffer
+    float EncodeDepth(float z) const {
+        if (depthMode == DEPTH_16)
+            return (reverseZ ? 1.0f - z : z) * 65535.0f;
+
+        return reverseZ ? -z : z;
+    }
+
+    // Plane through the values z1, z2, z3 at the triangle's vertices
+    ScreenPlane MakePlane(const Triangle &tri, float z1, float z2, float z3) const {
+        ScreenPlane plane;
+
+        float x1 = tri.p[0].x, y1 = height - tri.p[0].y;
+        float x2 = tri.p[1].x, y2 = height - tri.p[1].y;
+        float x3 = tri.p[2].x, y3 = height - tri.p[2].y;
+
+        plane.x0 = x1;
+        plane.y0 = y1;
+        plane.v0 = z1;
+        plane.a = plane.b = 0;
+
+        float det = (x2 - x1) * (y3 - y1) - (x3 - x1) * (y2 - y1);
+        if (det != 0) {
+            plane.a = ((z2 - z1) * (y3 - y1) - (z3 - z1) * (y2 - y1)) / det;
+            plane.b = ((x2 - x1) * (z3 - z1) - (x3 - x1) * (z2 - z1)) / det;
+        }
+
+        return plane;
+    }
+
+    ScreenPlane MakeDepthPlane(const Triangle &tri) const {
+        return MakePlane(tri, EncodeDepth(tri.p[0].z), EncodeDepth(tri.p[1].z), EncodeDepth(tri.p[2].z));
+    }
+
+    SpanColors MakeSpanColors(const Triangle &tri) const {
+        SpanColors colors;
+
+        colors.Setup(MakePlane(tri, (tri.c[0] >> 16) & 0xff, (tri.c[1] >> 16) & 0xff, (tri.c[2] >> 16) & 0xff),
+                     MakePlane(tri, (tri.c[0] >> 8) & 0xff, (tri.c[1] >> 8) & 0xff, (tri.c[2] >> 8) & 0xff),
+                     MakePlane(tri, tri.c[0] & 0xff, tri.c[1] & 0xff, tri.c[2] & 0xff));
+
+        return colors;
+    }
+
+    // Horizontal run of depth tested pixels, depth is a function of (x, y) only
+    // so a run gives the same result however it's split
+    template <typename T, bool SMOOTH>
+    void DrawSpanDepth(const RasterBuffers &buf, int sx, int ex, int y, uint32_t col, const ScreenPlane &plane,
+                       const SpanColors &colors) {
+        if (y < buf.clipY0 || y > buf.clipY1)
+            return;
+
+        if (sx < buf.clipX0) sx = buf.clipX0;
+        if (ex > buf.clipX1) ex = buf.clipX1;
+        if (sx > ex)
+            return;
+
+        if (buf.overdraw)
+            CountOverdraw(buf, sx, ex, y);
+
+        uint32_t* row = &buf.pixels[y * width];
+        T* zrow = (T*) buf.depth + y * width;
+        float* far = &depthFar[y * depthSegments];
+        float zy = plane.Row(y);
+
+        for (int seg = sx / DEPTH_SEGMENT; seg <= ex / DEPTH_SEGMENT; seg++) {
+            int s = std::max(sx, seg * DEPTH_SEGMENT);
+            int e = std::min(ex, seg * DEPTH_SEGMENT + DEPTH_SEGMENT - 1);
+
+            // Early reject, depth is linear along the run so its nearest
+            // point is one of the ends
+            T zs = StoreDepth<T>(plane.At(zy, s));
+            T ze = StoreDepth<T>(plane.At(zy, e));
+            if (std::min(zs, ze) >= far[seg])
+                continue;
+
+            SpanColors::v4 c;
+            if (SMOOTH)
+                c = colors.At(s, y);
+
+            // The farthest value of the run can only change if we
+            // overwrite a pixel holding it
+            T segFar = (T) far[seg];
+            bool hitFar = false;
+            for (int x = s; x <= e; x++) {
+                T z = StoreDepth<T>(plane.At(zy, x));
+                T old = zrow[x];
+                bool pass = z < old;
+
+                if (SMOOTH) {
+                    col = SpanColors::Pack(c);
+                    c += colors.step;
+                }
+
+                hitFar |= pass & (old == segFar);
+                zrow[x] = pass ? z : old;
+                row[x] = pass ? col : row[x];
+            }
+
+            if (hitFar) {
+                int start = seg * DEPTH_SEGMENT;
+                int end = std::min(width, start + DEPTH_SEGMENT);
+                T zmax = zrow[start];
+                for (int x = start + 1; x < end; x++)
+                    zmax = std::max(zmax, zrow[x]);
+                far[seg] = zmax;
+            }
+        }
+    }
+
+    // Draws everything still queued, the frame is complete when it returns
+    void Finish() {
+        ShadeVisible();
+    }
+
+    // Uploads the framebuffer into the streaming texture and shows the frame,
+    // or hands it to the present thread, drawing goes on in another framebuffer
+    void Present() {
+        ShadeVisible();
+
+        if (presenter) {
+            presenter->Submit(pixels, width, height);
+
+            // The framebuffer swapped in may be from before a resolution change
+            pixels.resize(width * height);
+            return;
+        }
+
+        if (target == TARGET_FRAMEBUFFER) {
+            SDL_Rect source = { 0, 0, width, height };
+
+            UploadFrame(texture, pixels.data(), width, height);
+            SDL_RenderCopy(renderer, texture, &source, NULL);
+        }
+
+        FlushBatches();
+        SDL_RenderPresent(renderer);
+    }
+
+    // Points land on top of the triangles drawn so far, shaded first with
+    // the visibility buffer
+    void DrawPoint(int x, int y) {
+        ShadeVisible();
+
+        if (target == TARGET_SDL) {
+            points.push_back({ x, y });
+            return;
+        }
+
+        if (x >= 0 && x < width && y >= 0 && y < height)
+            pixels[y * width + x] = drawColor;
+    }
+
+    // Horizontal run of pixels from sx to ex included
+    void DrawSpan(const RasterBuffers &buf, int sx, int ex, int y, uint32_t col) {
+        if (y < buf.clipY0 || y > buf.clipY1)
+            return;
+
+        if (sx < buf.clipX0) sx = buf.clipX0;
+        if (ex > buf.clipX1) ex = buf.clipX1;
+        if (sx > ex)
+            return;
+
+        if (target == TARGET_SDL) {
+            SetDrawColor(col);
+
+            // Runs of rows with the same span, common on thin vertical
+            // slivers, make one taller rectangle
+            SDL_Rect* last = rects.empty() ? NULL : &rects.back();
+            if (last && last->x == sx && last->w == ex - sx + 1 && last->y + last->h == y)
+                last->h++;
+            else
+                rects.push_back({ sx, y, ex - sx + 1, 1 });
+            return;
+        }
+
+        if (buf.overdraw)
+            CountOverdraw(buf, sx, ex, y);
+
+        uint32_t* row = &buf.pixels[y * width];
+        std::fill(row + sx, row + ex + 1, col);
+    }
+
+    // Draws the parts of the span no earlier span covered, smooth shaded
+    // when colors isn't NULL
+    void DrawSpanCovered(const RasterBuffers &buf, int sx, int ex, int y, uint32_t col, const SpanColors* colors) {
+        if (y < buf.clipY0 || y > buf.clipY1)
+            return;
+
+        if (sx < buf.clipX0) sx = buf.clipX0;
+        if (ex > buf.clipX1) ex = buf.clipX1;
+        if (sx > ex)
+            return;
+
+        int row = pool ? y * tilesX + buf.clipX0 / TILE_SIZE : y;
+        spans.Insert(row, sx, ex, [&](int s, int e) {
+            if (colors)
+                DrawSpanSmooth(buf, s, e, y, *colors);
+            else
+                DrawSpan(buf, s, e, y, col);
+        });
+    }
+
+    // Smooth shaded run of pixels, without depth test
+    void DrawSpanSmooth(const RasterBuffers &buf, int sx, int ex, int y, const SpanColors &colors) {
+        if (y < buf.clipY0 || y > buf.clipY1)
+            return;
+
+        if (sx < buf.clipX0) sx = buf.clipX0;
+        if (ex > buf.clipX1) ex = buf.clipX1;
+        if (sx > ex)
+            return;
+
+        if (buf.overdraw)
+            CountOverdraw(buf, sx, ex, y);
+
+        colors.Fill(&buf.pixels[y * width + sx], ex - sx + 1, colors.At(sx, y));
+    }
+
+    void CountOverdraw(const RasterBuffers &buf, int sx, int ex, int y) {
+        uint16_t* row = &buf.overdraw[y * width];
+        for (int x = sx; x <= ex; x++)
+            row[x]++;
+    }
+
+    // Bresenham from (x1, y1) to (x2, y2) included, calling plot(x, y) for
+    // each pixel
+    template <typename F>
+    void RasterizeLine(int x1, int y1, int x2, int y2, F plot) {
         int x, y, dx, dy, dx1, dy1, px, py, xe, ye, i;
-        int x1 = p1.x;
-        int x2 = p2.x;
-        int y1 = height - p1.y;
-        int y2 = height - p2.y;
 
         dx = x2 - x1; dy = y2 - y1;
         dx1 = abs(dx); dy1 = abs(dy);
@@ -53,7 +832,7 @@ struct Renderer {
             else
                 { x = x2; y = y2; xe = x1;}
 
-            SDL_RenderDrawPoint(renderer, x, y);
+            plot(x, y);
             
             for (i = 0; x<xe; i++)
             {
@@ -65,7 +844,7 @@ struct Renderer {
                     if ((dx<0 && dy<0) || (dx>0 && dy>0)) y = y + 1; else y = y - 1;
                     px = px + 2 * (dy1 - dx1);
                 }
-                SDL_RenderDrawPoint(renderer, x, y);
+                plot(x, y);
             }
         }
         else
@@ -75,7 +854,7 @@ struct Renderer {
             else
                 { x = x2; y = y2; ye = y1; }
 
-            SDL_RenderDrawPoint(renderer, x, y);
+            plot(x, y);
 
             for (i = 0; y<ye; i++)
             {
@@ -87,22 +866,41 @@ struct Renderer {
                     if ((dx<0 && dy<0) || (dx>0 && dy>0)) x = x + 1; else x = x - 1;
                     py = py + 2 * (dx1 - dy1);
                 }
-                SDL_RenderDrawPoint(renderer, x, y);
+                plot(x, y);
             }
         }
     }
 
+    // Clipped to the screen first, so every pixel is written without bounds
+    // checks and off-screen parts cost nothing
+    void DrawLine(Vec3d p1, Vec3d p2) {
+        float x1 = p1.x, y1 = height - p1.y;
+        float x2 = p2.x, y2 = height - p2.y;
+
+        // Pixel x covers [x, x + 1) and the ends are truncated
+        if (!ClipLine(x1, y1, x2, y2, 0, 0, nextafterf(width, 0), nextafterf(height, 0)))
+            return;
+
+        if (target == TARGET_SDL) {
+            RasterizeLine(x1, y1, x2, y2, [this](int x, int y) { points.push_back({ x, y }); });
+            return;
+        }
+
+        // Lines go on top of the triangles drawn so far
+        ShadeVisible();
+
+        uint32_t* px = pixels.data();
+        uint32_t col = drawColor;
+        RasterizeLine(x1, y1, x2, y2, [&](int x, int y) { px[y * width + x] = col; });
+    }
+
     void DrawLine(Vec3d p1, Vec3d p2, uint32_t col) {
-        uint8_t r, g, b;
-        HexToRGB(col, r, g, b);
-        SDL_SetRenderDrawColor(renderer, r, g, b, SDL_ALPHA_OPAQUE);
+        SetDrawColor(col);
         DrawLine(p1, p2);
     }
 
     void DrawTriangle(Triangle tri, uint32_t col) {
-        uint8_t r, g, b;
-        HexToRGB(col, r, g, b);
-        SDL_SetRenderDrawColor(renderer, r, g, b, SDL_ALPHA_OPAQUE);
+        SetDrawColor(col);
         DrawLine(tri.p[0], tri.p[1]);
         DrawLine(tri.p[1], tri.p[2]);
         DrawLine(tri.p[2], tri.p[0]);
@@ -113,15 +911,453 @@ struct Renderer {
         FillTriangle(tri);
     }
 
+    RasterBuffers Buffers() {
+        RasterBuffers buf;
+
+        buf.pixels = pixels.data();
+        buf.overdraw = countOverdraw ? overdraw.data() : NULL;
+        buf.depth = NULL;
+        if (depthMode == DEPTH_16) buf.depth = depth16.data();
+        if (depthMode == DEPTH_32F) buf.depth = depth32.data();
+
+        buf.width = width;
+        buf.height = height;
+        buf.clipX0 = buf.clipY0 = 0;
+        buf.clipX1 = width - 1;
+        buf.clipY1 = height - 1;
+
+        return buf;
+    }
+
+    // Buffers scissored to one of the screen tiles
+    RasterBuffers TileBuffers(int tile) {
+        RasterBuffers buf = Buffers();
+
+        buf.clipX0 = tile % tilesX * TILE_SIZE;
+        buf.clipY0 = tile / tilesX * TILE_SIZE;
+        buf.clipX1 = std::min(width, buf.clipX0 + TILE_SIZE) - 1;
+        buf.clipY1 = std::min(height, buf.clipY0 + TILE_SIZE) - 1;
+
+        return buf;
+    }
+
+    // Edge functions of the triangle with its vertices snapped to 1 / 2^bits
+    // of a pixel, false when they don't fit in 32 bits over the bounding box
+    bool MakeEdges(const Triangle &tri, const RasterBuffers &buf, int bits, EdgeSetup &s) const {
+        int64_t one = 1 << bits;
+        int64_t half = bits > 0 ? one / 2 : 0;
+
+        // Empty until the bounding box says otherwise
+        s.minX = 1;
+        s.maxX = 0;
+
+        int v[3] = { 0, 1, 2 };
+        int64_t x[3], y[3];
+        for (int i = 0; i < 3; i++) {
+            float fx = tri.p[i].x;
+            float fy = height - tri.p[i].y;
+
+            // Fixed point coordinates are rounded, whole pixels truncated
+            // the same way the scanline rasterizer does
+            if (bits > 0) {
+                x[i] = llrintf(fx * one);
+                y[i] = llrintf(fy * one);
+            } else {
+                x[i] = (int) fx;
+                y[i] = (int) fy;
+            }
+        }
+
+        int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (area == 0)
+            return true;
+
+        // Wind the edges so that the inside is positive
+        if (area < 0)
+            std::swap(v[1], v[2]);
+
+        s.minX = std::max<int64_t>(buf.clipX0, std::min(x[0], std::min(x[1], x[2])) >> bits);
+        s.maxX = std::min<int64_t>(buf.clipX1, std::max(x[0], std::max(x[1], x[2])) >> bits);
+        s.minY = std::max<int64_t>(buf.clipY0, std::min(y[0], std::min(y[1], y[2])) >> bits);
+        s.maxY = std::min<int64_t>(buf.clipY1, std::max(y[0], std::max(y[1], y[2])) >> bits);
+
+        if (s.minX > s.maxX || s.minY > s.maxY)
+            return true;
+
+        s.ox = s.minX & ~(EDGE_BLOCK - 1);
+        s.oy = s.minY & ~(EDGE_BLOCK - 1);
+
+        for (int i = 0; i < 3; i++) {
+            int a = v[i], b = v[(i + 1) % 3];
+            int64_t A = y[a] - y[b];
+            int64_t B = x[b] - x[a];
+
+            // E at the center of pixel (ox, oy), moving one pixel moves one in fixed point
+            int64_t C = A * (s.ox * one + half - x[a]) + B * (s.oy * one + half - y[a]);
+
+            // Top-left rule, pixel centers exactly on an edge belong to the
+            // triangle only if it's a left edge or a horizontal top edge
+            if (bits > 0 && !(A > 0 || (A == 0 && B > 0)))
+                C -= 1;
+
+            int64_t range = std::abs(C) + (std::abs(A) * (s.maxX - s.ox + EDGE_BLOCK)
+                                        + std::abs(B) * (s.maxY - s.oy + EDGE_BLOCK)) * one;
+            if (range > INT32_MAX)
+                return false;
+
+            s.A[i] = A * one;
+            s.B[i] = B * one;
+            s.C[i] = C;
+        }
+
+        return true;
+    }
+
+    // Returns false when the triangle covers no pixel of the scissor
+    bool MakeEdgeSetup(const Triangle &tri, const RasterBuffers &buf, ShadeMode shade, const Texture* tex,
+                       EdgeSetup &s) const {
+        // Huge triangles lose precision rather than overflowing
+        int bits = std::min(subPixelBits, SUBPIXEL_BITS_MAX);
+
+        while (!MakeEdges(tri, buf, bits, s)) {
+            if (bits == 0)
+                return false;
+            bits--;
+        }
+
+        if (s.minX > s.maxX || s.minY > s.maxY)
+            return false;
+
+        if (depthMode != DEPTH_NONE) {
+            s.depth = MakeDepthPlane(tri);
+
+            // Sampled at the pixel centers too
+            if (bits > 0) {
+                s.depth.x0 -= 0.5f;
+                s.depth.y0 -= 0.5f;
+            }
+        }
+
+        MakeShadeSetup(tri, shade, tex, bits > 0, s);
+
+        return true;
+    }
+
+    // Planes, texture and color the pixels of the triangle are shaded with,
+    // centers tells if pixels are sampled at their centers
+    void MakeShadeSetup(const Triangle &tri, ShadeMode shade, const Texture* tex, bool centers, EdgeSetup &s) const {
+        if (shade == SHADE_SMOOTH) {
+            s.red   = MakePlane(tri, (tri.c[0] >> 16) & 0xff, (tri.c[1] >> 16) & 0xff, (tri.c[2] >> 16) & 0xff);
+            s.green = MakePlane(tri, (tri.c[0] >> 8) & 0xff, (tri.c[1] >> 8) & 0xff, (tri.c[2] >> 8) & 0xff);
+            s.blue  = MakePlane(tri, tri.c[0] & 0xff, tri.c[1] & 0xff, tri.c[2] & 0xff);
+        }
+
+        if (shade == SHADE_TEXTURED) {
+            s.u = MakePlane(tri, tri.t[0].u, tri.t[1].u, tri.t[2].u);
+            s.v = MakePlane(tri, tri.t[0].v, tri.t[1].v, tri.t[2].v);
+            s.w = MakePlane(tri, tri.t[0].w, tri.t[1].w, tri.t[2].w);
+            s.wMin = std::min(tri.t[0].w, std::min(tri.t[1].w, tri.t[2].w));
+            s.wMax = std::max(tri.t[0].w, std::max(tri.t[1].w, tri.t[2].w));
+
+            // One mipmap level for the whole triangle, from the ratio of
+            // the texels it maps to the pixels it covers
+            float u[3], v[3];
+            for (int i = 0; i < 3; i++) {
+                u[i] = tri.t[i].u / tri.t[i].w * tex->Width();
+                v[i] = tri.t[i].v / tri.t[i].w * tex->Height();
+            }
+
+            float texels = fabsf((u[1] - u[0]) * (v[2] - v[0]) - (u[2] - u[0]) * (v[1] - v[0]));
+            float pixels = fabsf((tri.p[1].x - tri.p[0].x) * (tri.p[2].y - tri.p[0].y) -
+                                 (tri.p[2].x - tri.p[0].x) * (tri.p[1].y - tri.p[0].y));
+
+            s.mip = &tex->mips[tex->SelectMip(texels, pixels)];
+            s.filter = textureFilter;
+            s.subdivide = textureSubdivide;
+        }
+
+        if (centers) {
+            for (ScreenPlane* p : { &s.red, &s.green, &s.blue, &s.u, &s.v, &s.w }) {
+                p->x0 -= 0.5f;
+                p->y0 -= 0.5f;
+            }
+        }
+
+        s.col = tri.col;
+    }
+
+    void FillTriangleEdge(const Triangle &tri, const RasterBuffers &buf) {
+        EdgeSetup s;
+        ShadeMode shade = EffectiveShadeMode();
+
+        if (MakeEdgeSetup(tri, buf, shade, boundTexture, s))
+            RasterizeEdges(simdLevel, depthMode, shade, s, buf);
+    }
+
+    bool VisibilityPass() const {
+        return rasterMode == RASTER_VISIBILITY && !visibility.empty();
+    }
+
+    // First pass of RASTER_VISIBILITY, the flat edge rasterizer writes the
+    // triangle's ID, carried in its color, instead of shading it
+    void FillTriangleVisibility(const Triangle &tri, const RasterBuffers &buf) {
+        EdgeSetup s;
+        if (!MakeEdgeSetup(tri, buf, SHADE_FLAT, NULL, s))
+            return;
+
+        RasterBuffers ids = buf;
+        ids.pixels = visibility.data();
+
+        RasterizeEdges(simdLevel, depthMode, SHADE_FLAT, s, ids);
+    }
+
+    // Second pass of RASTER_VISIBILITY, every pixel of the triangles drawn
+    // since the last pass is shaded once, by the triangle nearest to it.
+    // Called by Present(), the texture filter and the affine subdivision
+    // are the ones set at that point.
+    void ShadeVisible() {
+        Flush();
+
+        if (!VisibilityPass() || visibleShaded == visible.size())
+            return;
+
+        reprojecting = false;
+        if (CheckerboardPass()) {
+            float scale, offset;
+            DepthDecoding(scale, offset);
+
+            if (previous.valid) {
+                reprojection.Setup(viewProj, previous, scale, offset, subPixelBits > 0 ? 0.5f : 0.0f);
+                reprojection.firstId = visibleShaded;
+                reprojecting = true;
+            }
+
+            if (!history.valid) {
+                history.Resize(width, height);
+                history.depthScale = scale;
+                history.depthOffset = offset;
+                history.viewProj = viewProj;
+                history.valid = true;
+            }
+        }
+
+        if (pool)
+            pool->Run(tilesX * tilesY, [this](int tile) { ShadeVisibleTile(TileBuffers(tile)); });
+        else
+            ShadeVisibleTile(Buffers());
+
+        visibleShaded = visible.size();
+    }
+
+    bool CheckerboardPass() const {
+        return checkerboard && VisibilityPass() && depthMode != DEPTH_NONE && viewProjSet;
+    }
+
+    // Keeps the pixels and depths of the block at (bx, by) inside the
+    // scissor for the next frame to reproject
+    void SaveHistory(const RasterBuffers &buf, int bx, int by) {
+        int x0 = std::max(bx, buf.clipX0), x1 = std::min(bx + EDGE_BLOCK - 1, buf.clipX1);
+        int y0 = std::max(by, buf.clipY0), y1 = std::min(by + EDGE_BLOCK - 1, buf.clipY1);
+        int n = x1 - x0 + 1;
+
+        for (int y = y0; y <= y1; y++) {
+            int i = y * width + x0;
+            int h = history.Index(x0, y);
+            memcpy(&history.pixels[h], &pixels[i], n * sizeof(uint32_t));
+
+            if (depthMode == DEPTH_16)
+                std::copy(&depth16[i], &depth16[i] + n, &history.depth[h]);
+            else
+                memcpy(&history.depth[h], &depth32[i], n * sizeof(float));
+        }
+    }
+
+    void ShadeVisibleTile(const RasterBuffers &buf) {
+        const int B = EDGE_BLOCK;
+        const int lanes = SimdLaneCount(simdLevel);
+        const bool saveHistory = CheckerboardPass();
+
+        // Setups of the triangles last met, neighbouring pixels mostly share one
+        const int CACHE_SIZE = 64;
+        uint32_t cachedId[CACHE_SIZE];
+        EdgeSetup cached[CACHE_SIZE];
+        std::fill(cachedId, cachedId + CACHE_SIZE, VISIBLE_NONE);
+
+        auto setup = [&](uint32_t id) -> const EdgeSetup& {
+            int slot = id % CACHE_SIZE;
+
+            if (cachedId[slot] != id) {
+                const VisibleTriangle &vt = visible[id];
+                MakeShadeSetup(vt.tri, vt.shade, vt.texture, subPixelBits > 0, cached[slot]);
+                cachedId[slot] = id;
+            }
+
+            return cached[slot];
+        };
+
+        // Groups of lanes laid out like the edge rasterizer's, blocks
+        // crossing the scissor are done one pixel at a time
+        for (int by = buf.clipY0 & ~(B - 1); by <= buf.clipY1; by += B) {
+            for (int bx = buf.clipX0 & ~(B - 1); bx <= buf.clipX1; bx += B) {
+                bool partial = bx < buf.clipX0 || by < buf.clipY0 || bx + B - 1 > buf.clipX1 || by + B - 1 > buf.clipY1;
+                int n = partial ? 1 : lanes;
+                int cellWidth = std::min(n, B), cellHeight = n / cellWidth;
+                SimdLevel level = partial ? SIMD_SCALAR : simdLevel;
+
+                for (int k = 0; k < B * B; k += n) {
+                    int x = bx + k % B, y = by + k / B;
+                    if (x < buf.clipX0 || x > buf.clipX1 || y < buf.clipY0 || y > buf.clipY1)
+                        continue;
+
+                    // Every other cell comes from the previous frame, what
+                    // it didn't show is shaded with the rest
+                    if (reprojecting && ((x / cellWidth + y / cellHeight + frameIndex) & 1)) {
+                        if (depthMode == DEPTH_16)
+                            Reproject<uint16_t>(level, reprojection, buf, visibility.data(), x, y);
+                        else
+                            Reproject<float>(level, reprojection, buf, visibility.data(), x, y);
+                    }
+
+                    // Each triangle of the group is shaded once, on its pixels
+                    const uint32_t* ids = &visibility[y * width + x];
+                    for (int i = 0; i < n; i++) {
+                        uint32_t id = ids[(i / B) * width + i % B];
+                        if (id == VISIBLE_NONE || id < visibleShaded)
+                            continue;
+
+                        bool seen = false;
+                        for (int j = 0; j < i && !seen; j++)
+                            seen = ids[(j / B) * width + j % B] == id;
+                        if (seen)
+                            continue;
+
+                        ::ShadeVisible(level, visible[id].shade, setup(id), buf, visibility.data(), id, x, y);
+                    }
+                }
+
+                // While the block is still in the cache
+                if (saveHistory)
+                    SaveHistory(buf, bx, by);
+            }
+        }
+    }
+
+    // Draws the triangle's pixels inside the scissor of buf, safe to call
+    // from several threads for different scissors. Only the edge function
+    // rasterizer does textures.
+    void RasterizeTriangle(const Triangle &tri, const RasterBuffers &buf) {
+        bool textured = EffectiveShadeMode() == SHADE_TEXTURED;
+
+        if (VisibilityPass())
+            FillTriangleVisibility(tri, buf);
+        else if (target == TARGET_FRAMEBUFFER && (rasterMode == RASTER_EDGE || (rasterMode == RASTER_SCANLINE && textured)))
+            FillTriangleEdge(tri, buf);
+        else
+            FillTriangleScanline(tri, buf);
+    }
+
+    // Queues the triangle into the bins of the tiles its bounding box touches
+    void BinTriangle(const Triangle &tri) {
+        int x1 = tri.p[0].x, x2 = tri.p[1].x, x3 = tri.p[2].x;
+        int y1 = height - tri.p[0].y, y2 = height - tri.p[1].y, y3 = height - tri.p[2].y;
+
+        int minX = std::max(0, std::min(x1, std::min(x2, x3)));
+        int maxX = std::min(width - 1, std::max(x1, std::max(x2, x3)));
+        int minY = std::max(0, std::min(y1, std::min(y2, y3)));
+        int maxY = std::min(height - 1, std::max(y1, std::max(y2, y3)));
+
+        if (minX > maxX || minY > maxY)
+            return;
+
+        uint32_t index = queued.size();
+        queued.push_back(tri);
+
+        for (int ty = minY / TILE_SIZE; ty <= maxY / TILE_SIZE; ty++)
+            for (int tx = minX / TILE_SIZE; tx <= maxX / TILE_SIZE; tx++)
+                bins[ty * tilesX + tx].push_back(index);
+    }
+
+    // Triangles in screen space, the few reaching past the guard band are
+    // clipped to it, the scissor of the rasterizers does the rest
     void FillTriangle(Triangle tri) {
+        float minX = std::min(tri.p[0].x, std::min(tri.p[1].x, tri.p[2].x));
+        float maxX = std::max(tri.p[0].x, std::max(tri.p[1].x, tri.p[2].x));
+        float minY = std::min(tri.p[0].y, std::min(tri.p[1].y, tri.p[2].y));
+        float maxY = std::max(tri.p[0].y, std::max(tri.p[1].y, tri.p[2].y));
+
+        if (maxX < 0 || minX > width || maxY < 0 || minY > height)
+            return;
+
+        if (minX >= -GUARD_BAND && maxX <= width + GUARD_BAND && minY >= -GUARD_BAND && maxY <= height + GUARD_BAND) {
+            FillTriangleInBand(tri);
+            return;
+        }
+
+        // Screen space, with w = 1 the planes' w is their offset. The
+        // rasterizers don't use the vertices' w.
+        Clipper band;
+        band.AddPlane( 1,  0, 0, GUARD_BAND);
+        band.AddPlane(-1,  0, 0, width + GUARD_BAND);
+        band.AddPlane( 0,  1, 0, GUARD_BAND);
+        band.AddPlane( 0, -1, 0, height + GUARD_BAND);
+
+        for (int i = 0; i < 3; i++)
+            tri.p[i].w = 1;
+
+        Triangle clipped[CLIP_TRIANGLES_MAX];
+        int n = band.Clip(tri, clipped);
+        for (int i = 0; i < n; i++)
+            FillTriangleInBand(clipped[i]);
+    }
+
+    void FillTriangleInBand(Triangle tri) {
+        // The first pass of the visibility buffer only needs the triangle's
+        // index, it's kept with its color for the shading pass
+        if (VisibilityPass()) {
+            visible.push_back({ tri, EffectiveShadeMode(), boundTexture });
+            tri.col = visible.size() - 1;
+        }
+
+        if (pool)
+            BinTriangle(tri);
+        else
+            RasterizeTriangle(tri, Buffers());
+    }
+
+    // The scanline rasterizer does flat and smooth shading, smooth only
+    // on the framebuffer
+    void FillTriangleScanline(const Triangle &tri, const RasterBuffers &buf) {
+        ScreenPlane plane;
+        if (depthMode != DEPTH_NONE && rasterMode != RASTER_SPANS)
+            plane = MakeDepthPlane(tri);
+
+        SpanColors colors;
+        bool smooth = target == TARGET_FRAMEBUFFER && EffectiveShadeMode() == SHADE_SMOOTH;
+        uint32_t col = target == TARGET_SDL ? QuantizeColor(tri.col) : tri.col;
+        if (smooth)
+            colors = MakeSpanColors(tri);
+
         auto SWAP = [](int &x, int &y) { int t = x; x = y; y = t; };
         auto drawline = [&](int sx, int ex, int ny) { 
-            uint8_t r, g, b;
-            HexToRGB(tri.col, r, g, b);
-            SDL_SetRenderDrawColor(renderer, r, g, b, SDL_ALPHA_OPAQUE);
-            SDL_RenderDrawLine(renderer, sx, ny, ex, ny);
-            //for (int i = sx; i <= ex; i++)
-            //    SDL_RenderDrawPoint(renderer, i, ny);
+            if (rasterMode == RASTER_SPANS) {
+                DrawSpanCovered(buf, sx, ex, ny, col, smooth ? &colors : NULL);
+                return;
+            }
+
+            if (smooth) {
+                switch (depthMode) {
+                    case DEPTH_NONE: DrawSpanSmooth(buf, sx, ex, ny, colors); break;
+                    case DEPTH_16:   DrawSpanDepth<uint16_t, true>(buf, sx, ex, ny, col, plane, colors); break;
+                    case DEPTH_32F:  DrawSpanDepth<float, true>(buf, sx, ex, ny, col, plane, colors); break;
+                }
+                return;
+            }
+
+            switch (depthMode) {
+                case DEPTH_NONE: DrawSpan(buf, sx, ex, ny, col); break;
+                case DEPTH_16:   DrawSpanDepth<uint16_t, false>(buf, sx, ex, ny, col, plane, colors); break;
+                case DEPTH_32F:  DrawSpanDepth<float, false>(buf, sx, ex, ny, col, plane, colors); break;
+            }
         };
         
         int t1x, t2x, y, minx, maxx, t1xp, t2xp;
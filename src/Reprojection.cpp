@@ -0,0 +1,244 @@
+#ifndef _REPROJECTION
+#define _REPROJECTION
+
+#include <stdint.h>
+#include <vector>
+
+#include "Mat4x4.cpp"
+#include "Simd.cpp"
+#include "Rasterizer.cpp"
+
+// Most difference between the view space depth a reprojected pixel should
+// have had in the previous frame and the one drawn there, relative. More
+// means it was another surface, hidden then or just uncovered.
+const float REPROJECT_DEPTH_TOLERANCE = 0.02f;
+
+// A finished frame kept for the next one to reuse, with the camera it was
+// drawn with. Pixels are stored by EDGE_BLOCK x EDGE_BLOCK blocks, one after
+// the other in rows of blocks, so that reading and writing them follows the
+// shading pass instead of striding across rows.
+struct FrameHistory {
+    std::vector<uint32_t> pixels;
+
+    // Depth buffer values, projected z = depth * depthScale + depthOffset.
+    // Pixels nothing covered hold the far plane, nothing reprojects there.
+    std::vector<float> depth;
+    float depthScale, depthOffset;
+
+    int width, height;
+    int blocksX;
+
+    // World to screen space, y up, before the division by w
+    Mat4x4 viewProj;
+    bool valid;
+
+    FrameHistory() {
+        depthScale = 1;
+        depthOffset = 0;
+        width = height = 0;
+        blocksX = 0;
+        valid = false;
+    }
+
+    void Resize(int w, int h) {
+        width = w;
+        height = h;
+        blocksX = (w + EDGE_BLOCK - 1) / EDGE_BLOCK;
+
+        int size = blocksX * ((h + EDGE_BLOCK - 1) / EDGE_BLOCK) * EDGE_BLOCK * EDGE_BLOCK;
+        pixels.resize(size);
+        depth.resize(size);
+    }
+
+    // Where pixel (x, y) is stored
+    int Index(int x, int y) const {
+        return ((y / EDGE_BLOCK) * blocksX + x / EDGE_BLOCK) * EDGE_BLOCK * EDGE_BLOCK + (y % EDGE_BLOCK) * EDGE_BLOCK + x % EDGE_BLOCK;
+    }
+};
+
+// Finds where the pixels of the frame being drawn were in the previous
+// one, from their depth and the two cameras. Only the camera moves, a
+// moving object is caught by the depth check at best.
+struct Reprojection {
+    const FrameHistory* previous;
+
+    // Current screen space to the previous one, up to a scale
+    float toPrevious[4][4];
+
+    // Last column of the inverse cameras, gives 1 / w of a screen space point
+    float currentW[4];
+    float previousW[4];
+
+    // Decodes the current depth buffer like FrameHistory's
+    float depthScale, depthOffset;
+
+    // Where pixels are sampled, 0.5 for their centers
+    float center;
+
+    // Pixels of triangles before this one were done by an earlier pass
+    uint32_t firstId;
+
+    Reprojection() {
+        previous = NULL;
+        depthScale = 1;
+        depthOffset = 0;
+        center = 0;
+        firstId = 0;
+    }
+
+    void Setup(const Mat4x4 &viewProj, const FrameHistory &prev, float scale, float offset, float sampleCenter) {
+        Mat4x4 inverse = Mat4x4::Inverse(viewProj);
+        Mat4x4 previousInverse = Mat4x4::Inverse(prev.viewProj);
+        Mat4x4 m = inverse * prev.viewProj;
+
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++)
+                toPrevious[i][j] = m.m[i][j];
+
+            currentW[i] = inverse.m[i][3];
+            previousW[i] = previousInverse.m[i][3];
+        }
+
+        previous = &prev;
+        depthScale = scale;
+        depthOffset = offset;
+        center = sampleCenter;
+    }
+};
+
+// N pixels of the visibility buffer laid out in rows of EDGE_BLOCK, starting
+// at (x, y), take the color they had in the previous frame and leave the
+// shading pass. Those off screen or behind something else then are kept.
+template <int N, typename T>
+SIMD_INLINE void ReprojectLanes(const Reprojection &r, const RasterBuffers &buf, uint32_t* ids, int x, int y) {
+    typedef Lanes<N> L;
+    typedef typename L::vi vi;
+    typedef typename L::vf vf;
+
+    const int W = N < EDGE_BLOCK ? N : EDGE_BLOCK;
+    const FrameHistory &prev = *r.previous;
+    const float (*m)[4] = r.toPrevious;
+    int offset = y * buf.width + x;
+    float height = buf.height;
+    float prevWidth = prev.width, prevHeight = prev.height;
+
+    // Masks come from a single comparison each, GCC turns a combination of
+    // them into scalar code on AVX-512. Here firstId <= id < VISIBLE_NONE,
+    // unsigned, on signed lanes.
+    vi id;
+    L::Load(id, ids + offset, W, buf.width);
+    vi mask = ((id - r.firstId) ^ INT32_MIN) < (int32_t) ((VISIBLE_NONE - r.firstId) ^ INT32_MIN);
+    if (!L::Any(mask))
+        return;
+
+    vf z;
+    if (sizeof(T) == 2) {
+        typename L::vh z16;
+        L::Load(z16, (const uint16_t*) buf.depth + offset, W, buf.width);
+        z = __builtin_convertvector(z16, vf);
+    } else {
+        L::Load(z, (const float*) buf.depth + offset, W, buf.width);
+    }
+    z = z * r.depthScale + r.depthOffset;
+
+    vi ramp;
+    L::Ramp(ramp);
+    vf sx = __builtin_convertvector(x + ramp % EDGE_BLOCK, vf) + r.center;
+    vf sy = height - (__builtin_convertvector(y + ramp / EDGE_BLOCK, vf) + r.center);
+
+    vf px = sx * m[0][0] + sy * m[1][0] + z * m[2][0] + m[3][0];
+    vf py = sx * m[0][1] + sy * m[1][1] + z * m[2][1] + m[3][1];
+    vf pw = sx * m[0][3] + sy * m[1][3] + z * m[2][3] + m[3][3];
+    vf invW = sx * r.currentW[0] + sy * r.currentW[1] + z * r.currentW[2] + r.currentW[3];
+
+    // Nearest pixel, shifted by one so that truncating rounds down. NaN
+    // and anything off screen or behind the camera end up at 0 or the
+    // size plus one, outside.
+    vf fx = px / pw - r.center + 1.5f;
+    vf fy = prevHeight - py / pw - r.center + 1.5f;
+    L::Select(fx, pw > 0, fx, vf {});
+    L::Clamp(fx, 0.0f, prevWidth + 1);
+    L::Clamp(fy, 0.0f, prevHeight + 1);
+
+    vi ix = __builtin_convertvector(fx, vi) - 1;
+    vi iy = __builtin_convertvector(fy, vi) - 1;
+    mask &= (ix | iy | (prev.width - 1 - ix) | (prev.height - 1 - iy)) >= 0;
+    if (!L::Any(mask))
+        return;
+
+    vi index = (((iy / EDGE_BLOCK) * prev.blocksX + ix / EDGE_BLOCK) * (EDGE_BLOCK * EDGE_BLOCK)
+             + (iy % EDGE_BLOCK) * EDGE_BLOCK + ix % EDGE_BLOCK) & mask;
+
+    int32_t idx[L::M];
+    float depths[L::M] = {};
+    int32_t colors[L::M] = {};
+    memcpy(idx, &index, sizeof(index));
+
+    for (int i = 0; i < N; i++) {
+        depths[i] = prev.depth[idx[i]];
+        colors[i] = prev.pixels[idx[i]];
+    }
+
+    vf pz;
+    vi col;
+    memcpy(&pz, depths, sizeof(pz));
+    memcpy(&col, colors, sizeof(col));
+
+    // Depth the previous frame had there against the one it should have
+    // had, w * previousInvW = 1 within the tolerance with w = pw / invW
+    pz = pz * prev.depthScale + prev.depthOffset;
+    vf psx = __builtin_convertvector(ix, vf) + r.center;
+    vf psy = prevHeight - (__builtin_convertvector(iy, vf) + r.center);
+    vf previousInvW = psx * r.previousW[0] + psy * r.previousW[1] + pz * r.previousW[2] + r.previousW[3];
+
+    vf d = pw * previousInvW - invW;
+    vf distance = (vf) ((vi) d & INT32_MAX);
+    mask &= distance <= invW * REPROJECT_DEPTH_TOLERANCE;
+
+    vi old;
+    int32_t* pp = (int32_t*) buf.pixels + offset;
+    L::Load(old, pp, W, buf.width);
+    L::Store(pp, W, buf.width, (col & mask) | (old & ~mask));
+    L::Store((int32_t*) ids + offset, W, buf.width, id | mask);
+}
+
+// One wrapper per instruction set, the kernel is inlined into them
+template <typename T>
+SIMD_EXACT void ReprojectScalar(const Reprojection &r, const RasterBuffers &buf, uint32_t* ids, int x, int y) {
+    ReprojectLanes<1, T>(r, buf, ids, x, y);
+}
+
+template <typename T>
+SIMD_TARGET("sse2") void ReprojectSSE2(const Reprojection &r, const RasterBuffers &buf, uint32_t* ids, int x, int y) {
+    ReprojectLanes<4, T>(r, buf, ids, x, y);
+}
+
+#ifdef SIMD_X86
+template <typename T>
+SIMD_TARGET("avx2") void ReprojectAVX2(const Reprojection &r, const RasterBuffers &buf, uint32_t* ids, int x, int y) {
+    ReprojectLanes<8, T>(r, buf, ids, x, y);
+}
+
+template <typename T>
+SIMD_TARGET("avx512f") void ReprojectAVX512(const Reprojection &r, const RasterBuffers &buf, uint32_t* ids, int x, int y) {
+    ReprojectLanes<16, T>(r, buf, ids, x, y);
+}
+#endif
+
+// T is the depth buffer's type
+template <typename T>
+void Reproject(SimdLevel level, const Reprojection &r, const RasterBuffers &buf, uint32_t* ids, int x, int y) {
+    switch (level) {
+#ifdef SIMD_X86
+        case SIMD_AVX512: ReprojectAVX512<T>(r, buf, ids, x, y); break;
+        case SIMD_AVX2:   ReprojectAVX2<T>(r, buf, ids, x, y); break;
+#else
+        case SIMD_AVX512:
+        case SIMD_AVX2:
+#endif
+        case SIMD_SSE2:   ReprojectSSE2<T>(r, buf, ids, x, y); break;
+        case SIMD_SCALAR: ReprojectScalar<T>(r, buf, ids, x, y); break;
+    }
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _RESOLUTIONSCALER
+#define _RESOLUTIONSCALER
+
+#include <math.h>
+#include <algorithm>
+
+// Weight of the newest frame in the smoothed drawing time
+const float RESOLUTION_SMOOTHING = 0.2f;
+
+// The scale only goes up once the frames take less than this share of the
+// budget, so it doesn't bounce between two sizes around the target
+const float RESOLUTION_HYSTERESIS = 0.8f;
+
+// Frames left alone after a change, while the measurements catch up
+const int RESOLUTION_COOLDOWN = 4;
+
+// Picks the framebuffer's scale, on both axes, from the measured drawing
+// time of the frames to hold them to a time budget
+struct ResolutionScaler {
+    float targetMs;
+    float minScale, maxScale;
+
+    float scale;
+    float averageMs;
+    int cooldown;
+
+    ResolutionScaler() {
+        targetMs = 16.0f;
+        minScale = 0.5f;
+        maxScale = 1.0f;
+        Reset();
+    }
+
+    void Reset() {
+        scale = maxScale;
+        averageMs = 0;
+        cooldown = 0;
+    }
+
+    // Takes the drawing time of the last frame, returns the scale of the next one
+    float Update(float frameMs) {
+        averageMs = averageMs == 0 ? frameMs : averageMs + (frameMs - averageMs) * RESOLUTION_SMOOTHING;
+
+        if (cooldown > 0) {
+            cooldown--;
+            return scale;
+        }
+
+        if (averageMs <= targetMs && averageMs >= targetMs * RESOLUTION_HYSTERESIS)
+            return scale;
+
+        // Drawing time follows the pixel count, the square of the scale. Aim
+        // for the middle of the band, going down quickly and up slowly.
+        float wanted = scale * sqrtf(targetMs * (1 + RESOLUTION_HYSTERESIS) * 0.5f / averageMs);
+        wanted = std::min(std::max(wanted, scale * 0.7f), scale * 1.1f);
+        wanted = std::min(std::max(wanted, minScale), maxScale);
+
+        if (fabsf(wanted - scale) < 0.01f)
+            return scale;
+
+        // Expected time at the new size, until it's measured
+        averageMs *= (wanted * wanted) / (scale * scale);
+        scale = wanted;
+        cooldown = RESOLUTION_COOLDOWN;
+
+        return scale;
+    }
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef _SIMD
+#define _SIMD
+
+#include <stdint.h>
+#include <string.h>
+
+// Instruction sets the SIMD kernels are built for, the best one the CPU
+// supports is picked at runtime
+enum SimdLevel {
+    SIMD_SCALAR,            // 1 lane
+    SIMD_SSE2,              // 4 lanes
+    SIMD_AVX2,              // 8 lanes
+    SIMD_AVX512,            // 16 lanes
+};
+
+// Kernels don't contract multiply-adds into FMAs, so every instruction set
+// rounds the same way and they all give bit-identical results
+#define SIMD_EXACT __attribute__((optimize("fp-contract=off")))
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#define SIMD_TARGET(isa) __attribute__((target(isa))) SIMD_EXACT
+#else
+#define SIMD_TARGET(isa) SIMD_EXACT
+#endif
+
+// Kernels are templates inlined into one small wrapper per instruction set,
+// so they get compiled for the wrapper's target
+#define SIMD_INLINE inline __attribute__((always_inline))
+
+inline SimdLevel DetectSimdLevel() {
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f"))
+        return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SIMD_SSE2;
+
+    return SIMD_SCALAR;
+#else
+    return SIMD_SSE2;
+#endif
+}
+
+inline const char* SimdLevelName(SimdLevel level) {
+    switch (level) {
+        case SIMD_SCALAR: return "scalar";
+        case SIMD_SSE2:   return "SSE2";
+        case SIMD_AVX2:   return "AVX2";
+        case SIMD_AVX512: return "AVX-512";
+    }
+
+    return "";
+}
+
+// Lanes of the kernels built for the level
+inline int SimdLaneCount(SimdLevel level) {
+    switch (level) {
+        case SIMD_SCALAR: return 1;
+        case SIMD_SSE2:   return 4;
+#ifdef SIMD_X86
+        case SIMD_AVX2:   return 8;
+        case SIMD_AVX512: return 16;
+#else
+        case SIMD_AVX2:
+        case SIMD_AVX512: return 4;
+#endif
+    }
+
+    return 1;
+}
+
+// N lanes wide vectors, using GCC vector extensions so the same kernel
+// source maps onto SSE2, AVX2 or AVX-512 registers. GCC turns one element
+// vectors into plain scalars, so they hold at least two lanes and only the
+// first N ones are loaded, stored and tested.
+template <int N>
+struct Lanes {
+    static const int M = N < 2 ? 2 : N;
+
+    typedef int32_t  vi __attribute__((vector_size(M * 4)));
+    typedef uint32_t vu __attribute__((vector_size(M * 4)));
+    typedef float    vf __attribute__((vector_size(M * 4)));
+    typedef uint16_t vh __attribute__((vector_size(M * 2)));
+
+    // Vectors are passed by reference, passing them by value from a kernel
+    // inlined into a wider target changes the ABI
+    static SIMD_INLINE void Ramp(vi &r) {
+        int32_t lanes[M];
+        for (int i = 0; i < M; i++)
+            lanes[i] = i;
+
+        memcpy(&r, lanes, sizeof(r));
+    }
+
+    // Every lane set to value, through memory like Ramp(): at -O1 GCC takes
+    // vi {} + value on 64 byte vectors for a read of an uninitialized one
+    static SIMD_INLINE void Splat(vi &r, int32_t value) {
+        int32_t lanes[M];
+        for (int i = 0; i < M; i++)
+            lanes[i] = value;
+
+        memcpy(&r, lanes, sizeof(r));
+    }
+
+    static SIMD_INLINE bool Any(const vi &mask) {
+        int32_t lanes[M];
+        memcpy(lanes, &mask, sizeof(mask));
+
+        int r = 0;
+        for (int i = 0; i < N; i++)
+            r |= lanes[i];
+
+        return r != 0;
+    }
+
+    static SIMD_INLINE void Select(vf &r, const vi &mask, const vf &a, const vf &b) {
+        r = (vf) (((vi) a & mask) | ((vi) b & ~mask));
+    }
+
+    static SIMD_INLINE void Clamp(vf &v, float lo, float hi) {
+        Select(v, v > lo, v, vf {} + lo);
+        Select(v, v < hi, v, vf {} + hi);
+    }
+
+    // Loads N values laid out as rows of `width` values, `stride` apart
+    template <typename V, typename T>
+    static SIMD_INLINE void Load(V &v, const T* p, int width, int stride) {
+        v = V {};
+        if (N <= width) {
+            memcpy(&v, p, N * sizeof(T));
+        } else {
+            for (int r = 0; r < N / width; r++)
+                memcpy((char*) &v + r * width * sizeof(T), p + r * stride, width * sizeof(T));
+        }
+    }
+
+    template <typename V, typename T>
+    static SIMD_INLINE void Store(T* p, int width, int stride, const V &v) {
+        if (N <= width) {
+            memcpy(p, &v, N * sizeof(T));
+        } else {
+            for (int r = 0; r < N / width; r++)
+                memcpy(p + r * stride, (const char*) &v + r * width * sizeof(T), width * sizeof(T));
+        }
+    }
+};
+
+#endif
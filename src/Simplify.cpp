@@ -0,0 +1,401 @@
+#ifndef _SIMPLIFY
+#define _SIMPLIFY
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <queue>
+#include <algorithm>
+
+#include "Vec3d.cpp"
+#include "Vertex.cpp"
+
+// Sum of the squared distances to a set of planes, the symmetric 4x4
+// matrix of Garland and Heckbert by its upper half. In doubles, the terms
+// of planes far from the origin mostly cancel out.
+struct Quadric {
+    double a[10];
+
+    Quadric() {
+        for (double &v : a)
+            v = 0;
+    }
+
+    // Plane x * p.x + y * p.y + z * p.z + d = 0, (x, y, z) of unit length
+    static Quadric FromPlane(double x, double y, double z, double d) {
+        Quadric q;
+
+        q.a[0] = x * x; q.a[1] = x * y; q.a[2] = x * z; q.a[3] = x * d;
+        q.a[4] = y * y; q.a[5] = y * z; q.a[6] = y * d;
+        q.a[7] = z * z; q.a[8] = z * d;
+        q.a[9] = d * d;
+
+        return q;
+    }
+
+    Quadric& operator +=(const Quadric &b) {
+        for (int i = 0; i < 10; i++)
+            a[i] += b.a[i];
+
+        return *this;
+    }
+
+    Quadric operator +(const Quadric &b) const {
+        Quadric r = *this;
+        return r += b;
+    }
+
+    double Error(const Vec3d &p) const {
+        double x = p.x, y = p.y, z = p.z;
+
+        double e = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+                 + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+                 + a[7] * z * z + 2 * a[8] * z + a[9];
+
+        // Rounding can take it under 0 on a flat surface
+        return std::max(0.0, e);
+    }
+};
+
+// Edge collapse simplification of a run of indexed triangles, cheapest
+// collapse by quadric error first. Mesh vertices at the same position are
+// one vertex here. Collapses move one vertex onto the other, so the
+// surface only goes through vertices of the original one, and the output
+// indexes the same mesh vertices. Corners moved take the first mesh
+// vertex found at their new position.
+//
+// Vertices on an open edge don't move, nor do those with texture seams.
+// A run simplified on its own thus keeps the boundary it shares with the
+// rest of the mesh, at every level.
+struct Simplifier {
+    struct Node {
+        Vec3d p;
+        Quadric q;
+
+        // First mesh vertex at this position
+        uint32_t vertex;
+
+        // Triangles using it, dead ones are dropped when it's collapsed onto
+        std::vector<uint32_t> tris;
+
+        // Bumped when the quadric or the triangles change, older collapses
+        // of the queue are stale
+        uint32_t stamp;
+        bool locked;
+        bool removed;
+    };
+
+    struct Collapse {
+        double cost;
+        uint32_t from, to;
+        uint32_t fromStamp, toStamp;
+
+        // Cheapest on top of the priority queue
+        bool operator <(const Collapse &b) const {
+            return cost > b.cost;
+        }
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> cornerVertices;
+    std::vector<bool> dead;
+    uint32_t triCount;
+
+    std::priority_queue<Collapse> queue;
+
+    Simplifier() {
+        triCount = 0;
+    }
+
+    // count triangles of meshIndices, three indices of meshVertices each
+    void Setup(const VertexStreams &meshVertices, const uint32_t* meshIndices, uint32_t count) {
+        nodes.clear();
+        indices.assign(count * 3, 0);
+        cornerVertices.assign(meshIndices, meshIndices + count * 3);
+        dead.assign(count, false);
+        queue = std::priority_queue<Collapse>();
+        triCount = count;
+
+        // Corners sorted by position, each node is a run of them
+        std::vector<uint32_t> corners(count * 3);
+        for (uint32_t i = 0; i < count * 3; i++)
+            corners[i] = i;
+
+        auto position = [&](uint32_t corner) { return meshVertices.Position(meshIndices[corner]); };
+        auto samePosition = [](const Vec3d &a, const Vec3d &b) { return a.x == b.x && a.y == b.y && a.z == b.z; };
+        std::sort(corners.begin(), corners.end(), [&](uint32_t a, uint32_t b) {
+            Vec3d pa = position(a), pb = position(b);
+            if (pa.x != pb.x) return pa.x < pb.x;
+            if (pa.y != pb.y) return pa.y < pb.y;
+            return pa.z < pb.z;
+        });
+
+        for (uint32_t i = 0; i < corners.size(); i++) {
+            uint32_t vertex = meshIndices[corners[i]];
+            Vec3d p = meshVertices.Position(vertex);
+
+            if (i == 0 || !samePosition(p, position(corners[i - 1]))) {
+                Node node;
+                node.p = p;
+                node.vertex = vertex;
+                node.stamp = 0;
+                node.locked = false;
+                node.removed = false;
+                nodes.push_back(node);
+            } else {
+                Node &node = nodes.back();
+                const Vec2d &t = meshVertices.t[vertex], &first = meshVertices.t[node.vertex];
+                node.locked |= t.u != first.u || t.v != first.v;
+            }
+
+            indices[corners[i]] = nodes.size() - 1;
+        }
+
+        // Degenerate triangles are left out, the others add their plane to
+        // their vertices
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t* v = &indices[i * 3];
+            Vec3d p0 = nodes[v[0]].p;
+            Vec3d normal = (nodes[v[1]].p - p0).cross(nodes[v[2]].p - p0);
+            float l = normal.length();
+
+            if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0] || l == 0) {
+                dead[i] = true;
+                triCount--;
+                continue;
+            }
+
+            normal /= l;
+            Quadric q = Quadric::FromPlane(normal.x, normal.y, normal.z, -normal.dot(p0));
+            for (int j = 0; j < 3; j++) {
+                nodes[v[j]].q += q;
+                nodes[v[j]].tris.push_back(i);
+            }
+        }
+
+        // Edges used by one triangle are open, more than two aren't a
+        // surface, the vertices of both stay
+        std::vector<uint64_t> edges;
+        for (uint32_t i = 0; i < count; i++) {
+            if (dead[i])
+                continue;
+
+            for (int j = 0; j < 3; j++) {
+                uint64_t a = indices[i * 3 + j], b = indices[i * 3 + (j + 1) % 3];
+                edges.push_back(std::min(a, b) << 32 | std::max(a, b));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+
+        for (size_t i = 0; i < edges.size(); ) {
+            size_t j = i;
+            while (j < edges.size() && edges[j] == edges[i])
+                j++;
+
+            if (j - i != 2)
+                nodes[edges[i] >> 32].locked = nodes[(uint32_t) edges[i]].locked = true;
+            i = j;
+        }
+
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+        for (uint64_t edge : edges) {
+            Push(edge >> 32, (uint32_t) edge);
+            Push((uint32_t) edge, edge >> 32);
+        }
+    }
+
+    void Push(uint32_t from, uint32_t to) {
+        const Node &a = nodes[from], &b = nodes[to];
+        if (a.locked)
+            return;
+
+        queue.push({ (a.q + b.q).Error(b.p), from, to, a.stamp, b.stamp });
+    }
+
+    // Other vertices of the live triangles around v, sorted
+    void Neighbours(uint32_t v, std::vector<uint32_t> &out) const {
+        out.clear();
+        for (uint32_t t : nodes[v].tris) {
+            if (dead[t])
+                continue;
+
+            for (int j = 0; j < 3; j++)
+                if (indices[t * 3 + j] != v)
+                    out.push_back(indices[t * 3 + j]);
+        }
+
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+
+    // The edge still exists, the vertices only share the triangles on it,
+    // which keeps the surface a manifold, and no triangle flips over
+    bool CanCollapse(uint32_t from, uint32_t to, std::vector<uint32_t> &a, std::vector<uint32_t> &b) const {
+        uint32_t shared = 0;
+        for (uint32_t t : nodes[from].tris) {
+            if (dead[t])
+                continue;
+
+            const uint32_t* v = &indices[t * 3];
+            if (v[0] == to || v[1] == to || v[2] == to) {
+                shared++;
+                continue;
+            }
+
+            Vec3d p[3], moved[3];
+            for (int j = 0; j < 3; j++) {
+                p[j] = nodes[v[j]].p;
+                moved[j] = v[j] == from ? nodes[to].p : p[j];
+            }
+
+            Vec3d before = (p[1] - p[0]).cross(p[2] - p[0]);
+            Vec3d after = (moved[1] - moved[0]).cross(moved[2] - moved[0]);
+            if (after.dot(before) <= 0)
+                return false;
+        }
+
+        if (shared == 0)
+            return false;
+
+        Neighbours(from, a);
+        Neighbours(to, b);
+
+        uint32_t common = 0;
+        for (size_t i = 0, j = 0; i < a.size() && j < b.size(); ) {
+            if (a[i] < b[j])
+                i++;
+            else if (b[j] < a[i])
+                j++;
+            else {
+                common++;
+                i++;
+                j++;
+            }
+        }
+
+        return common == shared;
+    }
+
+    // Collapses edges until at most target triangles are left, false when
+    // no more edges could go before that
+    bool Simplify(uint32_t target) {
+        std::vector<uint32_t> a, b;
+
+        while (triCount > target && !queue.empty()) {
+            Collapse c = queue.top();
+            queue.pop();
+
+            Node &from = nodes[c.from], &to = nodes[c.to];
+            if (from.removed || to.removed || from.stamp != c.fromStamp || to.stamp != c.toStamp)
+                continue;
+            if (!CanCollapse(c.from, c.to, a, b))
+                continue;
+
+            // Triangles on the edge go, the others now use `to`
+            for (uint32_t t : from.tris) {
+                if (dead[t])
+                    continue;
+
+                uint32_t* v = &indices[t * 3];
+                if (v[0] == c.to || v[1] == c.to || v[2] == c.to) {
+                    dead[t] = true;
+                    triCount--;
+                    continue;
+                }
+
+                for (int j = 0; j < 3; j++) {
+                    if (v[j] == c.from) {
+                        v[j] = c.to;
+                        cornerVertices[t * 3 + j] = to.vertex;
+                    }
+                }
+                to.tris.push_back(t);
+            }
+
+            to.tris.erase(std::remove_if(to.tris.begin(), to.tris.end(), [&](uint32_t t) { return (bool) dead[t]; }), to.tris.end());
+            from.tris.clear();
+            from.removed = true;
+            to.q += from.q;
+            to.stamp++;
+
+            // Edges around `to` cost more now
+            Neighbours(c.to, a);
+            for (uint32_t n : a) {
+                Push(n, c.to);
+                Push(c.to, n);
+            }
+        }
+
+        return triCount <= target;
+    }
+
+    // Closest point of triangle abc to p, from Ericson's Real-Time
+    // Collision Detection, by the region of the triangle p projects into
+    static Vec3d ClosestPoint(const Vec3d &p, const Vec3d &a, const Vec3d &b, const Vec3d &c) {
+        Vec3d ab = b - a, ac = c - a, ap = p - a;
+        float d1 = ab.dot(ap), d2 = ac.dot(ap);
+        if (d1 <= 0 && d2 <= 0)
+            return a;
+
+        Vec3d bp = p - b;
+        float d3 = ab.dot(bp), d4 = ac.dot(bp);
+        if (d3 >= 0 && d4 <= d3)
+            return b;
+
+        float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0 && d1 >= 0 && d3 <= 0)
+            return a + ab * (d1 / (d1 - d3));
+
+        Vec3d cp = p - c;
+        float d5 = ab.dot(cp), d6 = ac.dot(cp);
+        if (d6 >= 0 && d5 <= d6)
+            return c;
+
+        float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0 && d2 >= 0 && d6 <= 0)
+            return a + ac * (d2 / (d2 - d6));
+
+        float va = d3 * d6 - d5 * d4;
+        if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+            return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+        float denom = 1.0f / (va + vb + vc);
+        return a + ab * (vb * denom) + ac * (vc * denom);
+    }
+
+    // Furthest a removed vertex is from the triangles left, how far the
+    // surface moved. The quadrics only rank the collapses, their sums
+    // grow with the planes merged and overstate it.
+    float Error() const {
+        float error = 0;
+
+        for (const Node &v : nodes) {
+            if (!v.removed)
+                continue;
+
+            float nearest = INFINITY;
+            for (uint32_t i = 0; i < dead.size() && nearest > error; i++) {
+                if (dead[i])
+                    continue;
+
+                const uint32_t* t = &indices[i * 3];
+                Vec3d closest = ClosestPoint(v.p, nodes[t[0]].p, nodes[t[1]].p, nodes[t[2]].p);
+                nearest = std::min(nearest, (closest - v.p).length());
+            }
+
+            error = std::max(error, nearest);
+        }
+
+        return error;
+    }
+
+    // Mesh vertex indices of the triangles left, three each
+    void Output(std::vector<uint32_t> &out) const {
+        for (uint32_t i = 0; i < dead.size(); i++)
+            if (!dead[i])
+                out.insert(out.end(), &cornerVertices[i * 3], &cornerVertices[i * 3 + 3]);
+    }
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _SPANBUFFER
+#define _SPANBUFFER
+
+#include <vector>
+#include <algorithm>
+
+// Run of covered pixels of a row, from start to end included
+struct Span {
+    int start, end;
+};
+
+// Coverage buffer in the style of Quake's span buffer. Each row keeps its
+// covered spans sorted and merged, an incoming span only draws the parts
+// nothing covers yet, so with opaque triangles sent front to back every
+// pixel is written once and the cost follows the spans, not the pixels.
+struct SpanBuffer {
+    std::vector<std::vector<Span>> rows;
+
+    void Resize(int count) {
+        rows.assign(count, std::vector<Span>());
+    }
+
+    void Clear() {
+        for (auto &row : rows)
+            row.clear();
+    }
+
+    // Calls draw(sx, ex) for every uncovered part of [sx, ex] of the row,
+    // then marks the whole of it covered
+    template <typename F>
+    void Insert(int row, int sx, int ex, F draw) {
+        std::vector<Span> &spans = rows[row];
+
+        // First span touching or right next to the new one
+        auto first = std::lower_bound(spans.begin(), spans.end(), sx - 1,
+                                      [](const Span &s, int x) { return s.end < x; });
+
+        int x = sx;
+        int start = sx, end = ex;
+        auto last = first;
+
+        for (; last != spans.end() && last->start <= ex + 1; ++last) {
+            if (last->start > x)
+                draw(x, std::min(ex, last->start - 1));
+
+            x = std::max(x, last->end + 1);
+            start = std::min(start, last->start);
+            end = std::max(end, last->end);
+        }
+
+        if (x <= ex)
+            draw(x, ex);
+
+        // The spans it touched merge into one
+        if (first == last) {
+            spans.insert(first, { start, end });
+        } else {
+            first->start = start;
+            first->end = end;
+            spans.erase(first + 1, last);
+        }
+    }
+};
+
+#endif
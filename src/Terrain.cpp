@@ -0,0 +1,299 @@
+#ifndef _TERRAIN
+#define _TERRAIN
+
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "Vec2d.cpp"
+#include "Vec3d.cpp"
+#include "Triangle.cpp"
+#include "Texture.cpp"
+#include "Frustum.cpp"
+#include "Bvh.cpp"
+#include "Mesh.cpp"
+
+// Quads along a side of a patch, a power of two
+const int TERRAIN_PATCH = 16;
+
+// Levels of a patch, from every vertex to its four corners
+const int TERRAIN_LEVELS = 5;
+
+// Sides of a patch, toward its neighbours
+enum TerrainSide { SIDE_WEST, SIDE_EAST, SIDE_SOUTH, SIDE_NORTH };
+
+// A square of TERRAIN_PATCH quads of the grid, at (px, pz) in patches.
+// errors[l] is the most the heights of level l are off from the full grid.
+struct TerrainPatch {
+    int px, pz;
+    Vec3d bbMin, bbMax;
+    Vec3d center;
+    float radius;
+    float errors[TERRAIN_LEVELS];
+};
+
+// Regular grid of heights drawn as patches, each at its own level of a
+// geomipmap: level l keeps every 2^l-th vertex. Where a patch meets a
+// coarser one, the vertices of its edge that the other doesn't have are
+// moved along the edge onto the ones it does, so both share the same edge
+// and there's no crack nor T-junction.
+struct Terrain {
+    // Vertices along x and z, TERRAIN_PATCH times the patches plus one
+    int width, depth;
+    float x0, z0;
+    float spacing;
+    float uvScale;
+    std::vector<float> heights;
+    std::vector<Vec3d> normals;
+
+    // Patches in Morton order, and their index by position
+    int patchesX, patchesZ;
+    std::vector<TerrainPatch> patches;
+    std::vector<uint32_t> patchIndex;
+    BoxArrays patchBoxes;
+    Bvh bvh;
+
+    Terrain() {
+        width = depth = 0;
+        x0 = z0 = 0;
+        spacing = 1;
+        uvScale = 1;
+        patchesX = patchesZ = 0;
+    }
+
+    float Height(int x, int z) const {
+        x = std::max(0, std::min(width - 1, x));
+        z = std::max(0, std::min(depth - 1, z));
+
+        return heights[z * width + x];
+    }
+
+    Vec3d Position(int x, int z) const {
+        return { x0 + x * spacing, Height(x, z), z0 + z * spacing };
+    }
+
+    // Heights sampled every `spacing` over the mesh's box, by rays cast down
+    // through its BVH. Places the mesh doesn't cover get its lowest height.
+    // Texture coordinates are the position over uvScale, as GeneratePlanarUVs().
+    bool FromMesh(const Mesh &mesh, float fSpacing, float fUVScale) {
+        if (mesh.indices.empty() || fSpacing <= 0)
+            return false;
+
+        Vec3d size = mesh.bbMax - mesh.bbMin;
+        int quadsX = std::max(1, (int) ceilf(size.x / fSpacing / TERRAIN_PATCH)) * TERRAIN_PATCH;
+        int quadsZ = std::max(1, (int) ceilf(size.z / fSpacing / TERRAIN_PATCH)) * TERRAIN_PATCH;
+
+        width = quadsX + 1;
+        depth = quadsZ + 1;
+        x0 = mesh.bbMin.x;
+        z0 = mesh.bbMin.z;
+        spacing = fSpacing;
+        uvScale = fUVScale;
+        heights.assign(width * depth, mesh.bbMin.y);
+
+        Vec3d down = { 0, -1, 0 };
+        float top = mesh.bbMax.y + 1;
+        for (int z = 0; z < depth; z++) {
+            for (int x = 0; x < width; x++) {
+                RayHit hit;
+                if (mesh.Raycast({ x0 + x * spacing, top, z0 + z * spacing }, down, size.y + 2, hit))
+                    heights[z * width + x] = top - hit.t;
+            }
+        }
+
+        Build();
+        return true;
+    }
+
+    // Grey levels of a BMP or TGA image, 0 to 255 for heights 0 to
+    // fHeightScale, centered on the origin. Rows and columns past the last
+    // whole patch are dropped.
+    bool LoadHeightmap(const std::string &sFilename, float fSpacing, float fHeightScale, float fUVScale) {
+        Texture image;
+        if (!image.LoadFromFile(sFilename))
+            return false;
+
+        int quadsX = (image.Width() - 1) / TERRAIN_PATCH * TERRAIN_PATCH;
+        int quadsZ = (image.Height() - 1) / TERRAIN_PATCH * TERRAIN_PATCH;
+        if (quadsX == 0 || quadsZ == 0) {
+            fprintf(stderr, "Carte de hauteurs trop petite: %s\n", sFilename.c_str());
+            return false;
+        }
+
+        width = quadsX + 1;
+        depth = quadsZ + 1;
+        x0 = -0.5f * quadsX * fSpacing;
+        z0 = -0.5f * quadsZ * fSpacing;
+        spacing = fSpacing;
+        uvScale = fUVScale;
+        heights.resize(width * depth);
+
+        // Row 0 of the image is the far side, z going up
+        for (int z = 0; z < depth; z++) {
+            for (int x = 0; x < width; x++) {
+                uint32_t texel = image.mips[0].Get(x, depth - 1 - z);
+                float grey = (((texel >> 16) & 0xff) + ((texel >> 8) & 0xff) + (texel & 0xff)) / 3.0f;
+
+                heights[z * width + x] = grey / 255.0f * fHeightScale;
+            }
+        }
+
+        Build();
+        return true;
+    }
+
+    // Height at grid coordinates (fx, fz) of the level with vertices every
+    // `step`, on the same two triangles per quad as Triangulate()
+    float LevelHeight(float fx, float fz, int step) const {
+        int x = std::min((int) (fx / step), (width - 2) / step) * step;
+        int z = std::min((int) (fz / step), (depth - 2) / step) * step;
+        float u = (fx - x) / step, v = (fz - z) / step;
+
+        float a = Height(x, z), b = Height(x + step, z);
+        float c = Height(x + step, z + step), d = Height(x, z + step);
+
+        if (v >= u)
+            return a + v * (d - a) + u * (c - d);
+
+        return a + u * (b - a) + v * (c - b);
+    }
+
+    // Normals, patch bounds and errors, and the hierarchy over the patches
+    void Build() {
+        normals.resize(width * depth);
+        for (int z = 0; z < depth; z++) {
+            for (int x = 0; x < width; x++) {
+                Vec3d n = { Height(x - 1, z) - Height(x + 1, z), 2 * spacing, Height(x, z - 1) - Height(x, z + 1) };
+                normals[z * width + x] = n.normalized();
+            }
+        }
+
+        patchesX = (width - 1) / TERRAIN_PATCH;
+        patchesZ = (depth - 1) / TERRAIN_PATCH;
+
+        // Morton order, neighbours in space are close in the array as the
+        // BVH expects
+        std::vector<std::pair<uint32_t, uint32_t>> keys;
+        for (int pz = 0; pz < patchesZ; pz++)
+            for (int px = 0; px < patchesX; px++)
+                keys.push_back({ Mesh::SpreadBits(px) | (Mesh::SpreadBits(pz) << 1), pz * patchesX + px });
+        std::sort(keys.begin(), keys.end());
+
+        patches.clear();
+        patchBoxes.Clear();
+        patchIndex.assign(patchesX * patchesZ, 0);
+
+        for (auto &key : keys) {
+            TerrainPatch patch;
+            patch.px = key.second % patchesX;
+            patch.pz = key.second / patchesX;
+
+            int firstX = patch.px * TERRAIN_PATCH, firstZ = patch.pz * TERRAIN_PATCH;
+            float lo = Height(firstX, firstZ), hi = lo;
+            for (int z = firstZ; z <= firstZ + TERRAIN_PATCH; z++) {
+                for (int x = firstX; x <= firstX + TERRAIN_PATCH; x++) {
+                    lo = std::min(lo, Height(x, z));
+                    hi = std::max(hi, Height(x, z));
+                }
+            }
+
+            patch.bbMin = Position(firstX, firstZ);
+            patch.bbMax = Position(firstX + TERRAIN_PATCH, firstZ + TERRAIN_PATCH);
+            patch.bbMin.y = lo;
+            patch.bbMax.y = hi;
+            patch.center = (patch.bbMin + patch.bbMax) * 0.5f;
+            patch.radius = (patch.bbMax - patch.center).length();
+
+            // Vertical distance of every vertex to each level, coarser
+            // levels are never said to be closer
+            patch.errors[0] = 0;
+            for (int level = 1; level < TERRAIN_LEVELS; level++) {
+                float error = patch.errors[level - 1];
+
+                for (int z = firstZ; z <= firstZ + TERRAIN_PATCH; z++)
+                    for (int x = firstX; x <= firstX + TERRAIN_PATCH; x++)
+                        error = std::max(error, fabsf(Height(x, z) - LevelHeight(x, z, 1 << level)));
+
+                patch.errors[level] = error;
+            }
+
+            patchIndex[key.second] = patches.size();
+            patches.push_back(patch);
+            patchBoxes.Add(patch.bbMin, patch.bbMax);
+        }
+
+        bvh.Build(patchBoxes);
+    }
+
+    // Index of the patch past the side, -1 at the border of the terrain
+    int Neighbour(const TerrainPatch &patch, int side) const {
+        int px = patch.px + (side == SIDE_EAST) - (side == SIDE_WEST);
+        int pz = patch.pz + (side == SIDE_NORTH) - (side == SIDE_SOUTH);
+
+        if (px < 0 || pz < 0 || px >= patchesX || pz >= patchesZ)
+            return -1;
+
+        return patchIndex[pz * patchesX + px];
+    }
+
+    // Triangles of the patch at a level, object space. sideLevels are the
+    // levels of its neighbours, the edges toward coarser ones get their
+    // vertices.
+    void Triangulate(const TerrainPatch &patch, int level, const int sideLevels[4], std::vector<Triangle> &out) const {
+        int step = 1 << level;
+        int sideSteps[4];
+        for (int side = 0; side < 4; side++)
+            sideSteps[side] = 1 << std::max(level, sideLevels[side]);
+
+        // Along the edge down to the previous vertex of the coarser side,
+        // corners are on every level and stay
+        auto snap = [&](int &x, int &z) {
+            if (x == 0)
+                z -= z % sideSteps[SIDE_WEST];
+            else if (x == TERRAIN_PATCH)
+                z -= z % sideSteps[SIDE_EAST];
+            else if (z == 0)
+                x -= x % sideSteps[SIDE_SOUTH];
+            else if (z == TERRAIN_PATCH)
+                x -= x % sideSteps[SIDE_NORTH];
+        };
+
+        int firstX = patch.px * TERRAIN_PATCH, firstZ = patch.pz * TERRAIN_PATCH;
+        auto emit = [&](const int (&corners)[3][2]) {
+            int v[3][2];
+            for (int i = 0; i < 3; i++) {
+                v[i][0] = corners[i][0];
+                v[i][1] = corners[i][1];
+                snap(v[i][0], v[i][1]);
+            }
+
+            // Two corners moved onto the same vertex
+            for (int i = 0; i < 3; i++)
+                if (v[i][0] == v[(i + 1) % 3][0] && v[i][1] == v[(i + 1) % 3][1])
+                    return;
+
+            Triangle tri;
+            for (int i = 0; i < 3; i++) {
+                int x = firstX + v[i][0], z = firstZ + v[i][1];
+                tri.p[i] = Position(x, z);
+                tri.n[i] = normals[z * width + x];
+                tri.t[i] = Vec2d(tri.p[i].x / uvScale, tri.p[i].z / uvScale);
+            }
+
+            out.push_back(tri);
+        };
+
+        // Counterclockwise seen from above, as the mesh's front faces
+        for (int z = 0; z < TERRAIN_PATCH; z += step) {
+            for (int x = 0; x < TERRAIN_PATCH; x += step) {
+                emit({ { x, z }, { x, z + step }, { x + step, z + step } });
+                emit({ { x, z }, { x + step, z + step }, { x + step, z } });
+            }
+        }
+    }
+};
+
+#endif
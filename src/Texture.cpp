@@ -0,0 +1,309 @@
+#ifndef _TEXTURE
+#define _TEXTURE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <string>
+#include <fstream>
+
+// How texels are picked between texel centers
+enum TextureFilter {
+    FILTER_NEAREST,         // Closest texel
+    FILTER_BILINEAR,        // Blend of the four closest texels
+};
+
+// Texels are stored in TEXTURE_TILE x TEXTURE_TILE tiles of 64 bytes, one
+// cache line, so neighbours in both directions are usually loaded together
+const int TEXTURE_TILE = 4;
+
+// One level of the mipmap chain, 0x00RRGGBB texels. Tiles are stored row
+// by row and the texels inside a tile in Morton order.
+struct MipLevel {
+    int width, height;
+    int tilesX;
+    std::vector<uint32_t> texels;
+
+    void Resize(int w, int h) {
+        width = w;
+        height = h;
+        tilesX = (w + TEXTURE_TILE - 1) / TEXTURE_TILE;
+
+        int tilesY = (h + TEXTURE_TILE - 1) / TEXTURE_TILE;
+        texels.assign(tilesX * tilesY * TEXTURE_TILE * TEXTURE_TILE, 0);
+    }
+
+    // Index of texel (x, y) in texels
+    int Swizzle(int x, int y) const {
+        int tile = (y >> 2) * tilesX + (x >> 2);
+        int morton = (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2);
+
+        return (tile << 4) | morton;
+    }
+
+    uint32_t Get(int x, int y) const {
+        return texels[Swizzle(x, y)];
+    }
+
+    void Set(int x, int y, uint32_t col) {
+        texels[Swizzle(x, y)] = col;
+    }
+};
+
+// Blends two texels with a weight out of 256, two channels at a time
+inline uint32_t LerpTexel(uint32_t a, uint32_t b, uint32_t t) {
+    uint32_t rb = ((a & 0xff00ff) * (256 - t) + (b & 0xff00ff) * t) >> 8;
+    uint32_t g  = ((a & 0x00ff00) * (256 - t) + (b & 0x00ff00) * t) >> 8;
+
+    return (rb & 0xff00ff) | (g & 0x00ff00);
+}
+
+struct Texture {
+    std::vector<MipLevel> mips;
+
+    int Width() const {
+        return mips.empty() ? 0 : mips[0].width;
+    }
+
+    int Height() const {
+        return mips.empty() ? 0 : mips[0].height;
+    }
+
+    // Row major 0x00RRGGBB texels, row 0 at the top, the mipmap chain is built right away
+    void Create(int w, int h, const uint32_t* rgb) {
+        mips.clear();
+        if (w <= 0 || h <= 0)
+            return;
+
+        MipLevel base;
+        base.Resize(w, h);
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++)
+                base.Set(x, y, rgb[y * w + x]);
+
+        mips.push_back(base);
+        BuildMipmaps();
+    }
+
+    // Each level averages 2x2 texels of the previous one, down to 1x1
+    void BuildMipmaps() {
+        mips.resize(1);
+
+        while (mips.back().width > 1 || mips.back().height > 1) {
+            const MipLevel &src = mips.back();
+            MipLevel dst;
+            dst.Resize(std::max(1, src.width / 2), std::max(1, src.height / 2));
+
+            for (int y = 0; y < dst.height; y++) {
+                for (int x = 0; x < dst.width; x++) {
+                    int x0 = std::min(x * 2, src.width - 1), x1 = std::min(x * 2 + 1, src.width - 1);
+                    int y0 = std::min(y * 2, src.height - 1), y1 = std::min(y * 2 + 1, src.height - 1);
+
+                    uint32_t top = LerpTexel(src.Get(x0, y0), src.Get(x1, y0), 128);
+                    uint32_t bottom = LerpTexel(src.Get(x0, y1), src.Get(x1, y1), 128);
+                    dst.Set(x, y, LerpTexel(top, bottom, 128));
+                }
+            }
+
+            mips.push_back(dst);
+        }
+    }
+
+    // Level for a triangle covering `texels` texels of the base level on `pixels` pixels
+    int SelectMip(float texels, float pixels) const {
+        if (mips.empty() || texels <= pixels || pixels <= 0)
+            return 0;
+
+        int level = (int) (0.5f * log2f(texels / pixels));
+        return std::min(level, (int) mips.size() - 1);
+    }
+
+    // Coordinates wrap, (0, 0) is the top left corner and (1, 1) the bottom right one
+    uint32_t Sample(float u, float v, int level, TextureFilter filter) const {
+        if (mips.empty())
+            return 0;
+
+        const MipLevel &mip = mips[std::min(level, (int) mips.size() - 1)];
+
+        u = (u - floorf(u)) * mip.width;
+        v = (v - floorf(v)) * mip.height;
+
+        if (filter == FILTER_NEAREST) {
+            int x = std::min((int) u, mip.width - 1);
+            int y = std::min((int) v, mip.height - 1);
+
+            return mip.Get(x, y);
+        }
+
+        // Texel centers are at half coordinates
+        u -= 0.5f;
+        v -= 0.5f;
+
+        int x0 = (int) floorf(u), y0 = (int) floorf(v);
+        uint32_t fx = (uint32_t) ((u - x0) * 256.0f);
+        uint32_t fy = (uint32_t) ((v - y0) * 256.0f);
+
+        if (x0 < 0) x0 += mip.width;
+        if (y0 < 0) y0 += mip.height;
+        int x1 = x0 + 1 < mip.width ? x0 + 1 : 0;
+        int y1 = y0 + 1 < mip.height ? y0 + 1 : 0;
+
+        uint32_t top = LerpTexel(mip.Get(x0, y0), mip.Get(x1, y0), fx);
+        uint32_t bottom = LerpTexel(mip.Get(x0, y1), mip.Get(x1, y1), fx);
+
+        return LerpTexel(top, bottom, fy);
+    }
+
+    // Two colors checkerboard, used when there's no image to load
+    void CreateChecker(int size, int squares, uint32_t col1, uint32_t col2) {
+        std::vector<uint32_t> rgb(size * size);
+        int square = std::max(1, size / squares);
+
+        for (int y = 0; y < size; y++)
+            for (int x = 0; x < size; x++)
+                rgb[y * size + x] = ((x / square + y / square) & 1) ? col2 : col1;
+
+        Create(size, size, rgb.data());
+    }
+
+    // Uncompressed 24 or 32 bits BMP, or TGA, picked from the extension
+    bool LoadFromFile(std::string sFilename) {
+        std::ifstream f(sFilename, std::ios::binary);
+        if (!f.is_open())
+            return false;
+
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+        std::string ext = sFilename.substr(sFilename.find_last_of('.') + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+        if (ext == "bmp")
+            return LoadBMP(data);
+        if (ext == "tga")
+            return LoadTGA(data);
+
+        return false;
+    }
+
+    static uint32_t ReadLE(const std::vector<uint8_t> &data, size_t offset, int bytes) {
+        uint32_t r = 0;
+        for (int i = 0; i < bytes; i++)
+            r |= (uint32_t) data[offset + i] << (i * 8);
+
+        return r;
+    }
+
+    bool LoadBMP(const std::vector<uint8_t> &data) {
+        if (data.size() < 54 || data[0] != 'B' || data[1] != 'M')
+            return false;
+
+        uint32_t offset = ReadLE(data, 10, 4);
+        int w = (int32_t) ReadLE(data, 18, 4);
+        int h = (int32_t) ReadLE(data, 22, 4);
+        int bpp = ReadLE(data, 28, 2);
+        uint32_t compression = ReadLE(data, 30, 4);
+
+        // Only BI_RGB, or BI_BITFIELDS with the usual masks for 32 bits
+        // INT_MIN has no absolute value
+        if ((bpp != 24 && bpp != 32) || (compression != 0 && compression != 3) || w <= 0 || h == 0 || h == INT_MIN)
+            return false;
+
+        // A negative height means rows are stored top down
+        bool bottomUp = h > 0;
+        h = abs(h);
+
+        // Divided rather than multiplied, so no size can wrap around
+        int bytes = bpp / 8;
+        size_t pitch = ((size_t) w * bytes + 3) & ~(size_t) 3;
+        if (offset > data.size() || (data.size() - offset) / pitch < (size_t) h)
+            return false;
+
+        std::vector<uint32_t> rgb(w * h);
+        for (int y = 0; y < h; y++) {
+            size_t row = offset + pitch * (bottomUp ? h - 1 - y : y);
+
+            for (int x = 0; x < w; x++) {
+                const uint8_t* p = &data[row + x * bytes];
+                rgb[y * w + x] = (p[2] << 16) | (p[1] << 8) | p[0];
+            }
+        }
+
+        Create(w, h, rgb.data());
+        return true;
+    }
+
+    // Uncompressed or RLE true color TGA
+    bool LoadTGA(const std::vector<uint8_t> &data) {
+        if (data.size() < 18)
+            return false;
+
+        int idLength = data[0];
+        int type = data[2];
+        int w = ReadLE(data, 12, 2);
+        int h = ReadLE(data, 14, 2);
+        int bpp = data[16];
+        bool topDown = data[17] & 0x20;
+
+        if ((type != 2 && type != 10) || (bpp != 24 && bpp != 32) || w == 0 || h == 0)
+            return false;
+
+        int bytes = bpp / 8;
+        size_t pos = 18 + idLength + ReadLE(data, 5, 2) * ((data[7] + 7) / 8);
+        std::vector<uint32_t> rgb(w * h);
+
+        auto readPixel = [&](uint32_t &col) {
+            if (pos + bytes > data.size())
+                return false;
+
+            col = (data[pos + 2] << 16) | (data[pos + 1] << 8) | data[pos];
+            pos += bytes;
+            return true;
+        };
+
+        int n = 0;
+        while (n < w * h) {
+            uint32_t col;
+
+            if (type == 2) {
+                if (!readPixel(col))
+                    return false;
+                rgb[n++] = col;
+                continue;
+            }
+
+            // RLE packets, the high bit tells a run of one repeated pixel from raw pixels
+            if (pos >= data.size())
+                return false;
+
+            int header = data[pos++];
+            int count = std::min((header & 0x7f) + 1, w * h - n);
+
+            if (header & 0x80) {
+                if (!readPixel(col))
+                    return false;
+                std::fill(rgb.begin() + n, rgb.begin() + n + count, col);
+                n += count;
+            } else {
+                for (int i = 0; i < count; i++) {
+                    if (!readPixel(col))
+                        return false;
+                    rgb[n++] = col;
+                }
+            }
+        }
+
+        if (!topDown) {
+            for (int y = 0; y < h / 2; y++)
+                std::swap_ranges(rgb.begin() + y * w, rgb.begin() + (y + 1) * w, rgb.begin() + (h - 1 - y) * w);
+        }
+
+        Create(w, h, rgb.data());
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef _THREADPOOL
+#define _THREADPOOL
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+// Fixed set of worker threads running batches of indexed jobs
+struct ThreadPool {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    std::function<void(int)> job;
+    int jobCount;
+    std::atomic<int> nextJob;
+    int busy;
+    unsigned generation;
+    bool quit;
+
+    // The thread calling Run() takes part, so this starts threads - 1 workers
+    ThreadPool(int threads) {
+        jobCount = 0;
+        nextJob = 0;
+        busy = 0;
+        generation = 0;
+        quit = false;
+
+        for (int i = 1; i < threads; i++)
+            workers.emplace_back([this] { Worker(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+
+        for (auto &t : workers)
+            t.join();
+    }
+
+    int Size() const {
+        return workers.size() + 1;
+    }
+
+    // Runs f(0) .. f(count - 1) spread over all the threads, jobs are handed
+    // out one at a time so uneven jobs balance out. Returns when all are done.
+    void Run(int count, const std::function<void(int)> &f) {
+        if (workers.empty()) {
+            for (int i = 0; i < count; i++)
+                f(i);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = f;
+            jobCount = count;
+            nextJob = 0;
+            busy = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        Work();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busy == 0; });
+    }
+
+    void Work() {
+        int i;
+        while ((i = nextJob++) < jobCount)
+            job(i);
+    }
+
+    void Worker() {
+        unsigned seen = 0;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return quit || generation != seen; });
+                if (quit)
+                    return;
+                seen = generation;
+            }
+
+            Work();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0)
+                done.notify_one();
+        }
+    }
+};
+
+#endif
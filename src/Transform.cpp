@@ -0,0 +1,144 @@
+#ifndef _TRANSFORM
+#define _TRANSFORM
+
+#include <stdint.h>
+#include <vector>
+
+#include "Vec3d.cpp"
+#include "Mat4x4.cpp"
+#include "Clipper.cpp"
+#include "Vertex.cpp"
+#include "Simd.cpp"
+
+// Vertices through TransformVertices(), one array per value as the kernels
+// store them: clip space positions, their Clipper::Outcode(), and where
+// they land on the screen for the triangles that need no clipping
+struct ProjectedVertices {
+    std::vector<float> cx, cy, cz, cw;
+    std::vector<float> sx, sy, sz;
+    std::vector<uint32_t> outcode;
+
+    void Resize(uint32_t count) {
+        for (std::vector<float>* v : { &cx, &cy, &cz, &cw, &sx, &sy, &sz })
+            v->resize(count);
+        outcode.resize(count);
+    }
+
+    uint32_t Size() const {
+        return cx.size();
+    }
+
+    Vec3d Clip(uint32_t i) const {
+        Vec3d p = { cx[i], cy[i], cz[i] };
+        p.w = cw[i];
+
+        return p;
+    }
+
+    // Divided by w, w itself stays as the clip space one like the
+    // triangles projected after clipping
+    Vec3d Screen(uint32_t i) const {
+        Vec3d p = { sx[i], sy[i], sz[i] };
+        p.w = cw[i];
+
+        return p;
+    }
+};
+
+// Vertices [first, last) of the streams, N at a time, through the matrix
+// into clip space, then divided by w and mapped to the screen in the same
+// pass. Every step is the same arithmetic in the same order as for the
+// triangles, so they get the same bits. Returns the first vertex left over.
+template <int N>
+SIMD_INLINE int TransformVerticesLanes(const Mat4x4 &m, const Clipper &clipper, float halfWidth, float halfHeight,
+                                       const VertexStreams &in, int first, int last, ProjectedVertices &out) {
+    typedef Lanes<N> L;
+    typedef typename L::vi vi;
+    typedef typename L::vf vf;
+
+    int i = first;
+    for (; i + N <= last; i += N) {
+        vf x, y, z;
+        L::Load(x, &in.x[i], N, N);
+        L::Load(y, &in.y[i], N, N);
+        L::Load(z, &in.z[i], N, N);
+
+        // Row vectors as Mat4x4::operator*(const Vec3d&), w is 1
+        vf cx = x * m.m[0][0] + y * m.m[1][0] + z * m.m[2][0] + m.m[3][0];
+        vf cy = x * m.m[0][1] + y * m.m[1][1] + z * m.m[2][1] + m.m[3][1];
+        vf cz = x * m.m[0][2] + y * m.m[1][2] + z * m.m[2][2] + m.m[3][2];
+        vf cw = x * m.m[0][3] + y * m.m[1][3] + z * m.m[2][3] + m.m[3][3];
+
+        vi code = {};
+        for (int p = 0; p < clipper.planeCount; p++) {
+            const ClipPlane &plane = clipper.planes[p];
+            vf d = cx * plane.x + cy * plane.y + cz * plane.z + cw * plane.w;
+
+            code |= (d < 0) & (1 << p);
+            code |= (d + cw * plane.guard < 0) & (1 << (p + 8));
+        }
+
+        // Adding 0 to z too, as the triangles get (1, 1, 0)
+        vf sx = (cx / cw + 1.0f) * halfWidth;
+        vf sy = (cy / cw + 1.0f) * halfHeight;
+        vf sz = cz / cw + 0.0f;
+
+        L::Store(&out.cx[i], N, N, cx);
+        L::Store(&out.cy[i], N, N, cy);
+        L::Store(&out.cz[i], N, N, cz);
+        L::Store(&out.cw[i], N, N, cw);
+        L::Store(&out.sx[i], N, N, sx);
+        L::Store(&out.sy[i], N, N, sy);
+        L::Store(&out.sz[i], N, N, sz);
+        L::Store(&out.outcode[i], N, N, code);
+    }
+
+    return i;
+}
+
+// One wrapper per instruction set, the kernel is inlined into them
+inline SIMD_EXACT int TransformVerticesScalar(const Mat4x4 &m, const Clipper &clipper, float halfWidth, float halfHeight,
+                                              const VertexStreams &in, int first, int last, ProjectedVertices &out) {
+    return TransformVerticesLanes<1>(m, clipper, halfWidth, halfHeight, in, first, last, out);
+}
+
+inline SIMD_TARGET("sse2") int TransformVerticesSSE2(const Mat4x4 &m, const Clipper &clipper, float halfWidth, float halfHeight,
+                                                    const VertexStreams &in, int first, int last, ProjectedVertices &out) {
+    return TransformVerticesLanes<4>(m, clipper, halfWidth, halfHeight, in, first, last, out);
+}
+
+#ifdef SIMD_X86
+inline SIMD_TARGET("avx2") int TransformVerticesAVX2(const Mat4x4 &m, const Clipper &clipper, float halfWidth, float halfHeight,
+                                                    const VertexStreams &in, int first, int last, ProjectedVertices &out) {
+    return TransformVerticesLanes<8>(m, clipper, halfWidth, halfHeight, in, first, last, out);
+}
+
+inline SIMD_TARGET("avx512f") int TransformVerticesAVX512(const Mat4x4 &m, const Clipper &clipper, float halfWidth, float halfHeight,
+                                                         const VertexStreams &in, int first, int last, ProjectedVertices &out) {
+    return TransformVerticesLanes<16>(m, clipper, halfWidth, halfHeight, in, first, last, out);
+}
+#endif
+
+// Transforms the count vertices from first on into the same places of out,
+// which holds as many vertices as in. What's left after a kernel's full
+// groups of lanes goes to the narrower ones, as in CullBoxes().
+inline void TransformVertices(SimdLevel level, const Mat4x4 &m, const Clipper &clipper, float halfWidth, float halfHeight,
+                              const VertexStreams &in, int first, int count, ProjectedVertices &out) {
+    int last = first + count;
+
+    switch (level) {
+#ifdef SIMD_X86
+        case SIMD_AVX512: first = TransformVerticesAVX512(m, clipper, halfWidth, halfHeight, in, first, last, out); [[fallthrough]];
+        case SIMD_AVX2:   first = TransformVerticesAVX2(m, clipper, halfWidth, halfHeight, in, first, last, out); [[fallthrough]];
+#else
+        case SIMD_AVX512:
+        case SIMD_AVX2:
+#endif
+        case SIMD_SSE2:   first = TransformVerticesSSE2(m, clipper, halfWidth, halfHeight, in, first, last, out); break;
+        case SIMD_SCALAR: break;
+    }
+
+    TransformVerticesScalar(m, clipper, halfWidth, halfHeight, in, first, last, out);
+}
+
+#endif
@@ -1,13 +1,20 @@
+#ifndef _VEC2D
+#define _VEC2D
+
+// Texture coordinates, after projection u and v are divided by the vertex
+// w and w holds 1 / w so all three interpolate linearly on the screen
 struct Vec2d {
-    float u, v;
+    float u, v, w;
 
     Vec2d() {
         u = v = 0;
+        w = 1;
     }
     
     Vec2d(float a, float b) {
         u = a;
         v = b;
+        w = 1;
     }
 
     Vec2d operator +(const Vec2d& b) const {
@@ -15,6 +22,7 @@ struct Vec2d {
 
         r.u = u + b.u;
         r.v = v + b.v;
+        r.w = w + b.w;
 
         return r;
     }
@@ -24,6 +32,7 @@ struct Vec2d {
 
         r.u = u - b.u;
         r.v = v - b.v;
+        r.w = w - b.w;
 
         return r;
     }
@@ -33,7 +42,10 @@ struct Vec2d {
 
         r.u = u * b;
         r.v = v * b;
+        r.w = w * b;
 
         return r;
     }
-};
\ No newline at end of file
+};
+
+#endif
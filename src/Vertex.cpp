@@ -0,0 +1,66 @@
+#ifndef _VERTEX
+#define _VERTEX
+
+#include <stdint.h>
+#include <vector>
+
+#include "Vec2d.cpp"
+#include "Vec3d.cpp"
+
+// A vertex of an indexed mesh, shared by the triangles around it. Corners
+// at one position with different texture coordinates are different vertices.
+struct Vertex {
+    Vec3d p;
+    Vec2d t;
+
+    // Object space normal, for lighting the vertex
+    Vec3d n;
+};
+
+// The vertices of a mesh as streams. Positions are read by every frame's
+// transform, one array per coordinate so the SIMD kernels load several
+// vertices at once. Texture coordinates and normals are only read for the
+// triangles drawn and the shading that needs them, and stay out of the way.
+struct VertexStreams {
+    std::vector<float> x, y, z;
+    std::vector<Vec2d> t;
+    std::vector<Vec3d> n;
+
+    uint32_t Size() const {
+        return x.size();
+    }
+
+    bool Empty() const {
+        return x.empty();
+    }
+
+    void Clear() {
+        for (std::vector<float>* v : { &x, &y, &z })
+            v->clear();
+        t.clear();
+        n.clear();
+    }
+
+    void Add(const Vertex &v) {
+        x.push_back(v.p.x);
+        y.push_back(v.p.y);
+        z.push_back(v.p.z);
+        t.push_back(v.t);
+        n.push_back(v.n);
+    }
+
+    Vec3d Position(uint32_t i) const {
+        return { x[i], y[i], z[i] };
+    }
+
+    Vertex Get(uint32_t i) const {
+        return { Position(i), t[i], n[i] };
+    }
+
+    // Bytes per vertex over all the streams
+    static size_t VertexSize() {
+        return 3 * sizeof(float) + sizeof(Vec2d) + sizeof(Vec3d);
+    }
+};
+
+#endif